@@ -25,10 +25,10 @@
  * For more information, please refer to <https://unlicense.org>
  ***************************************************************************/
 /*---------------------------------------------------------------------------
-    Lib SLI v1.02
+    Lib SLI v1.03
 
     Author  : White Guy That Don't Smile
-    Date    : 2023/07/31, Monday, July 31st; 1222 HOURS
+    Date    : 2026/10/19, Monday, October 19th; 1222 HOURS
     License : UnLicense | Public Domain
 
     This is a C library for processing Nintendo's SLI data.
@@ -64,6 +64,8 @@
     Additionally, the SLI format is to be regarded as the intellectual
     property of << Nintendo EAD >> and << "Melody-Yoshi" >>.
 ---------------------------------------------------------------------------*/
+#define _XOPEN_SOURCE 700
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -71,6 +73,12 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 
 
@@ -87,6 +95,7 @@ typedef uint32_t u32;
 #define FILE_SIZE_ERROR 2
 #define RAM_UNAVAILABLE 3
 #define FILE_READ_ERROR 4
+#define BAD_ENCODING    5
 
 static void display_error(const int errcode, const void *data)
 {
@@ -103,15 +112,34 @@ static void display_error(const int errcode, const void *data)
         case FILE_READ_ERROR:
             printf("FILE READ ERROR!\n");
             break;
+        case BAD_ENCODING:
+            printf("BAD ENCODING!\n");
+            break;
         default:
-            printf("\n##  Lempel-Ziv SLI Zip v1.02 [2023/07/31]  ##\n"
-              "\nUsage:  lzsz [mode] [type] [infile]\n"
+            printf("\n##  Lempel-Ziv SLI Zip v1.03 [2026/10/19]  ##\n"
+              "\nUsage:  lzsz [mode] [type] [infile] [options]\n"
+              "        lzsz l [threads] [socket] [-j [trace]]\n"
               "\nModes:\n  e  : Encode\n  d  : Decode\n"
+              "  s  : Encode, keeping the Smallest of [type]\n"
+              "  p  : Predict the encoded sizes of [type]\n"
+              "  l  : Listen on a local socket as a server\n"
               "\nTypes:\n  m  : MIO0   \"Mario\"\n"
               "  g  : SMSR00 \"Mario 2\"\n"
               "  z  : Yay0   \"Zelda\"\n"
               "  i  : Yaz0   \"Zelda 2\"\n"
-              "  r  : Rvl0   \"Revolution\"\n\n");
+              "  r  : Rvl0   \"Revolution\"\n"
+              "\nSeveral types may be given at once to encode, e.g. \"mzr\",\n"
+              "sharing a single match finding pass between them.\n"
+              "\nOptions:\n  -c [socket] : Have the server at [socket] do it\n"
+              "  -t [count]  : Find matches ahead with [count] threads\n"
+              "  -p [prev] [prevout] : Reuse the encode [prevout] of [prev]\n"
+              "  -r [permil] : Let -p take [permil] more than a full parse\n"
+              "  -f          : Find matches through hash chains\n"
+              "  -v          : Verify every match found against the SDK's\n"
+              "  -u          : Check untrusted input while decoding\n"
+              "  -j [trace]  : Write a timeline of the run to [trace]\n"
+              "  -d [ms]     : Encode within [ms] milliseconds\n"
+              "  -x          : Skip searching where nothing repeats\n\n");
             break;
     }
 
@@ -235,6 +263,23 @@ static vec_t *vrealloc(vec_t *vec)
     return vec;
 }
 
+/*  Empties "vec" for reuse, or replaces it if its width isn't "size". */
+static vec_t *vreuse(vec_t *vec, const size_t size)
+{
+    if (vec == NULL) {
+        return valloc(size);
+    }
+
+    if (vec->wd != size) {
+        vfree(vec);
+        return valloc(size);
+    }
+
+    vec->ct = 0;
+    vec->cur = vec->org;
+    return vec;
+}
+
 static void vappend(vec_t *vec, const void *data)
 {
     if (vec == NULL) {
@@ -259,6 +304,175 @@ static void vappend(vec_t *vec, const void *data)
 
 
 
+/*---------------------------------------------------------------------------
+
+                                Trace Section
+
+---------------------------------------------------------------------------*/
+
+
+
+/*  Given a trace file, every thread records the spans it goes through, per
+    file and per phase, into blocks of its own, so that recording never
+    waits on another thread; the list of threads is only locked once per
+    thread, on its first span.  A span is recorded once it ends, so that
+    spans cut short are simply left out.  They are all written out at exit
+    as Chrome trace events, once every thread recording them has ended.
+    Names too long to keep, such as paths, keep their end. */
+#define TRACE_BLOCK 0x100
+
+typedef struct evt_s {
+    unsigned long long ts, /* start, in microseconds */
+                       dur;
+    char name[48];
+} evt_t;
+
+typedef struct trb_s {
+    struct trb_s *next;
+    unsigned ct;
+    evt_t ev[TRACE_BLOCK];
+} trb_t;
+
+typedef struct trc_s {
+    struct trc_s *next;
+    unsigned tid;
+    trb_t *head, *tail;
+} trc_t;
+
+static const char *tracefile = NULL;
+static pthread_key_t trkey;
+static pthread_mutex_t trmu = PTHREAD_MUTEX_INITIALIZER;
+static trc_t *traces = NULL;
+static unsigned trids = 0;
+
+/*  Returns a steady time in microseconds. */
+static unsigned long long clock_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000ULL +
+           (unsigned long long)(now.tv_nsec / 1000);
+}
+
+/*  Returns the time to start a span at, or zero when not tracing. */
+static unsigned long long trace_now(void)
+{
+    return (tracefile == NULL) ? 0 : clock_us();
+}
+
+/*  Records the span "name", from "start" up to now. */
+static void span(const char *name, const unsigned long long start)
+{
+    trc_t *t;
+    trb_t *b;
+    evt_t *e;
+    size_t n;
+
+    if (tracefile == NULL) {
+        return;
+    }
+
+    if ((t = (trc_t *)pthread_getspecific(trkey)) == NULL) {
+        if ((t = (trc_t *)calloc(1, sizeof(trc_t))) == NULL) {
+            return;
+        }
+
+        pthread_mutex_lock(&trmu);
+        t->tid = ++trids;
+        t->next = traces;
+        traces = t;
+        pthread_mutex_unlock(&trmu);
+        pthread_setspecific(trkey, t);
+    }
+
+    if (((b = t->tail) == NULL) || (b->ct == TRACE_BLOCK)) {
+        if ((b = (trb_t *)calloc(1, sizeof(trb_t))) == NULL) {
+            return;
+        }
+
+        if (t->tail != NULL) {
+            t->tail->next = b;
+        }
+        else {
+            t->head = b;
+        }
+
+        t->tail = b;
+    }
+
+    e = &b->ev[b->ct];
+    e->ts = start;
+    e->dur = trace_now() - start;
+
+    if ((n = strlen(name)) < sizeof(e->name)) {
+        memcpy(e->name, name, n + 1);
+    }
+    else {
+        memcpy(e->name, "...", 3);
+        memcpy(&e->name[3], &name[n - (sizeof(e->name) - 4)],
+               sizeof(e->name) - 3);
+    }
+
+    b->ct++;
+    return;
+}
+
+static void trace_dump(void)
+{
+    FILE *ofile;
+    trc_t *t;
+    trb_t *b;
+    unsigned i, n = 0;
+    const char *c;
+
+    if ((ofile = fopen(tracefile, "w")) == NULL) {
+        display_error(BAD_ARGS, (void *)tracefile);
+        return;
+    }
+
+    fprintf(ofile, "{\"traceEvents\":[");
+    pthread_mutex_lock(&trmu);
+
+    for (t = traces; t != NULL; t = t->next) {
+        for (b = t->head; b != NULL; b = b->next) {
+            for (i = 0; i < b->ct; ++i) {
+                fprintf(ofile, "%s\n{\"name\":\"", (n++ != 0) ? "," : "");
+
+                for (c = b->ev[i].name; *c != '\0'; ++c) {
+                    if ((*c == '"') || (*c == '\\')) {
+                        fputc('\\', ofile);
+                    }
+
+                    fputc(((u8)*c < 0x20) ? '?' : *c, ofile);
+                }
+
+                fprintf(ofile, "\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                        "\"pid\":%ld,\"tid\":%u}", b->ev[i].ts,
+                        b->ev[i].dur, (long)getpid(), t->tid);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&trmu);
+    fprintf(ofile, "\n]}\n");
+    fclose(ofile);
+    return;
+}
+
+/*  Starts recording spans, to be written to "name" at exit. */
+static void trace_open(const char *name)
+{
+    if ((tracefile == NULL) && (pthread_key_create(&trkey, NULL) == 0)) {
+        tracefile = name;
+        atexit(trace_dump);
+    }
+
+    return;
+}
+
+
+
 /*---------------------------------------------------------------------------
 
                                  SLI Section
@@ -274,10 +488,7 @@ typedef struct hdr_s {
         b; /* Offset to Bytes */
 } hdr_t;
 
-hdr_t header;
-static i16 values[0x100];
-
-static void initskip(u8 *pat, const i32 patlen)
+static void initskip(i16 *values, u8 *pat, const i32 patlen)
 {
     i32 i;
 
@@ -295,6 +506,7 @@ static void initskip(u8 *pat, const i32 patlen)
 static i32 mischarsearch(u8 *pat, const i32 patlen,
                          u8 *text, const i32 textlen)
 {
+    i16 values[0x100];
     i32 c, j, p;
     u32 t;
 
@@ -302,7 +514,7 @@ static i32 mischarsearch(u8 *pat, const i32 patlen,
         return textlen;
     }
 
-    initskip(pat, patlen);
+    initskip(values, pat, patlen);
     p = patlen + -1;
 
     do {
@@ -378,519 +590,3327 @@ static void search(u8 *src, u8 *srcp, u8 *srcz, u32 *o, u32 *l, const u32 x)
     return;
 }
 
-static void assemble_tables(u8 *dstp, u8 *dstz,
-                            vec_t *flags, vec_t *dicts, vec_t *bytes)
+/*  search() settles on the furthest of the longest matches in the window,
+    or on the furthest to reach the maximum length.  search_hash() finds the
+    very same match by following chains of the positions which share their
+    first three bytes, from the furthest onward, so that only the
+    positions able to match at all are ever compared. */
+#define HASH_BITS 15
+
+static int fast = 0;   /* search_hash() in place of search() */
+static int verify = 0; /* check every match against search() */
+
+typedef struct fnd_s {
+    u32 head[1U << HASH_BITS], /* latest position + 1 of every hash */
+        prev[0x1000],          /* the one before it, by position */
+        cand[0x1000];          /* positions of a chain in the window */
+    u8 *ins;                   /* next position to be hashed */
+    u32 depth;                 /* nearest candidates searched, zero for all */
+} fnd_t;
+
+static u32 hash3(const u8 *p)
 {
-    u32 *c = (u32 *)&dstp[0], *cz = &c[flags->ct],
-        *cmdp = flags->org, tmp;
-    u16 *p = (u16 *)&dstp[flags->ct << 2], *pz = &p[dicts->ct],
-        *polp = dicts->org;
-    u8 *defp = bytes->org;
+    u32 k = ((u32)p[0] << 16) | ((u32)p[1] << 8) | (u32)p[2];
 
-    do {
-        dstp = &dstp[(flags->ct << 2) + (dicts->ct << 1)];
+    return (k * 0x9E3779B1U) >> (32 - HASH_BITS);
+}
 
-        while (c < cz) {
-            tmp = *cmdp++;
-            strinv(&tmp, 4);
-            *c++ = tmp;
-        }
+/*  Positions ahead of "at" are hashed as the searches reach them. */
+static void fnd_open(fnd_t *f, u8 *at)
+{
+    memset(f->head, 0, sizeof(f->head));
+    f->ins = at;
+    f->depth = 0;
+    return;
+}
 
-        while (p < pz) {
-            tmp = *polp++;
-            strinv(&tmp, 2);
-            *p++ = tmp;
-        }
+static void search_hash(fnd_t *f, u8 *src, u8 *srcp, u8 *srcz,
+                        u32 *o, u32 *l, const u32 x)
+{
+    u32 cnt = srcz - srcp, best = 2U, n = 0, r, a, h, k, pk = 0;
+    u8 *pos = (((srcp - src) < 0x1001U) ? src : &srcp[~0xFFF]), *c, *bc,
+       *pc = NULL;
 
-        while (dstp < dstz) {
-            *dstp++ = *defp++;
+    if ((x - 1U) < cnt) {
+        cnt = x;
+    }
+
+    while (f->ins < srcp) {
+        if (&f->ins[2] < srcz) {
+            a = f->ins - src;
+            h = hash3(f->ins);
+            f->prev[a & 0xFFF] = f->head[h];
+            f->head[h] = a + 1U;
         }
-    } while (0);
 
-    return;
-}
+        f->ins++;
+    }
 
-static void assemble_groups(u8 *dstp, u8 *dstz,
-                            vec_t *flags, vec_t *dicts, vec_t *bytes)
-{
-    u16 *h = (u16 *)&dstp[0], *hz = &h[flags->ct + dicts->ct],
-        *cmdp = flags->org, *polp = dicts->org, n = 0, tmp;
-    u8 *defp = bytes->org;
-    i16 f;
+    *l = 0;
+    *o = 0;
 
-    do {
-        while (h < hz) {
-            if (n != 0) {
-                if ((f < 0) == 0) {
-                    tmp = *polp++;
-                    strinv(&tmp, 2);
-                    *h++ = tmp;
-                }
+    if (cnt < 3U) {
+        return;
+    }
 
-                f <<= 1;
-                --n;
-            }
-            else {
-                tmp = *cmdp++;
-                f = (i16)tmp;
-                strinv(&tmp, 2);
-                *h++ = tmp;
-                n = 16;
-            }
+    /*  Behind a long leading run the chain holds every position of every
+        run of its byte in the window, which search() skips over instead. */
+    for (r = 1; (r < cnt) && (srcp[r] == *srcp); ++r);
+
+    if ((r >= 0x40) && (f->depth == 0)) {
+        search(src, srcp, srcz, o, l, x);
+        return;
+    }
+
+    for (a = f->head[hash3(srcp)];
+         (a != 0) && (&src[a - 1U] >= pos) &&
+         ((f->depth == 0) || (n < f->depth));
+         a = f->prev[(a - 1U) & 0xFFF]) {
+        f->cand[n++] = a - 1U;
+    }
+
+    /*  Against a leading run "r" long, a match still running at c[r] stops
+        there, so it cannot beat any match as long, and a match "pk" long at
+        c - 1 leaves c with one byte less of the run when it ended before
+        c[r], or r - 1 bytes when it went on past it. */
+    for (bc = NULL; n != 0; pc = c, pk = k) {
+        c = &src[f->cand[--n]];
+
+        if ((c == &pc[1]) && (pk != 0) && (pk != r)) {
+            k = ((pk < r) ? pk : r) - 1U;
+        }
+        else if ((*&c[best] != *&srcp[best]) ||
+                 ((r <= best) && (r < cnt) && (c[r] == *srcp))) {
+            k = 0;
+            continue;
+        }
+        else {
+            for (k = 0; (k < cnt) && (*&c[k] == *&srcp[k]); ++k);
         }
 
-        dstp = &dstp[(flags->ct << 1) + (dicts->ct << 1)];
+        if (k > best) {
+            best = k;
+            bc = c;
 
-        while (dstp < dstz) {
-            *dstp++ = *defp++;
+            if (k == cnt) {
+                break;
+            }
         }
-    } while (0);
+    }
+
+    if (bc != NULL) {
+        *o = &srcp[-1] - bc;
+        *l = best;
+    }
 
     return;
 }
 
-static void assemble_stream(u8 *dstp, u8 *dstz,
-                            vec_t *flags, vec_t *dicts, vec_t *bytes)
+/*  Inside a run of a byte, or of a pattern of 2 or 4 bytes, spanning the
+    whole window, search() can only end one way: every candidate aligned to
+    the pattern matches up to the end of the run and no further, while no
+    other candidate matches as many bytes as the pattern's size, so it picks
+    the furthest aligned candidate.  Runs are tracked by a frontier that only
+    moves forward, so every byte of the input is checked once per pattern
+    size however many positions are searched within them; asking behind the
+    frontier again is still answered right, only less often, as a stretch
+    known to repeat there can only have started later. */
+typedef struct run_s {
+    u8 *gs[3], /* start of the stretch repeating every 1, 2 and 4 bytes */
+       *ge[3]; /* extent checked so far */
+} run_t;
+
+static void run_open(run_t *r, u8 *src)
 {
-    u8 *cmdp = flags->org, *defp = bytes->org, n = 0, f;
-    u16 *polp = dicts->org, tmp;
+    u32 i;
 
-    do {
-        while (dstp < dstz) {
-            if (n != 0) {
-                if ((f & 0x80) == 0) {
-                    tmp = *polp;
-                    strinv(&tmp, 2);
-                    memcpy(dstp, &tmp, 2);
-                    dstp = &dstp[2];
+    for (i = 0; i < 3; ++i) {
+        r->gs[i] = src;
+        r->ge[i] = &src[1U << i];
+    }
 
-                    if ((*polp >> 12) == 0) {
-                        *dstp++ = *defp++;
-                    }
+    return;
+}
 
-                    polp = &polp[1];
-                }
-                else {
-                    *dstp++ = *defp++;
-                }
+/*  Leaves "r" as run_open() at "at" would once checked up to "to", looking
+    back from "to" for where each stretch starts, which in most data is
+    only a few bytes away. */
+static void run_seek(run_t *r, u8 *at, u8 *to)
+{
+    u32 i, p;
+    u8 *g;
 
-                f <<= 1;
-                --n;
-            }
-            else {
-                f = *cmdp++;
-                *dstp++ = f;
-                n = 8;
+    run_open(r, at);
+
+    for (i = 0; i < 3; ++i) {
+        p = 1U << i;
+
+        for (g = to; g > r->ge[i]; --g) {
+            if (g[-1] != g[-1 - (i32)p]) {
+                r->gs[i] = &g[-(i32)p];
+                break;
             }
         }
-    } while (0);
+
+        r->ge[i] = (to > r->ge[i]) ? to : r->ge[i];
+    }
 
     return;
 }
 
-static void encode(u8 *src, u8 *srcz, FILE *ofile)
+/*  Answers the search at "srcp" from the runs alone when it lies in one.
+    Returns zero when it does not. */
+static int search_runs(run_t *r, u8 *src, u8 *srcp, u8 *srcz,
+                       u32 *o, u32 *l, const u32 x)
 {
-    void (*assemble)(u8 *, u8 *, vec_t *, vec_t *, vec_t *);
-    u8 *srcp, *dst, *dstp, *dstz, b;
-    u16 h;
-    u32 mask, bitflags, o[2], l[2], size, T;
-    vec_t *bytes, *dicts, *flags;
-    u32 q[2][5] = { { 0x12, 0x12,
-                      0x111, 0x111,
-                      0x10110 },
-                    { 0x4D494F30, 0x534D5352,
-                      0x59617930, 0x59617A30,
-                      0x52766C30 } },
-        x = *&q[0][*srcz],
-        m = *&q[1][*srcz];
-
-    bitflags = 0x00000000U;
-    bytes = valloc(1);
-    dicts = valloc(2);
-
-    switch (*srcz) {
-        case 1:     /* Mario 2 */
-            T = 0x8000U;
-            flags = valloc(2);
-            break;
-        case 3:     /* Zelda 2 */
-            T = 0x80U;
-            flags = valloc(1);
-            break;
-        default:
-            T = 0x80000000U;
-            flags = valloc(4);
-            break;
+    u32 cnt = srcz - srcp, i, p;
+    u8 *pos = (((srcp - src) < 0x1001U) ? src : &srcp[~0xFFF]), *z;
+
+    if ((x - 1U) < cnt) {
+        cnt = x;
     }
 
-    mask = T;
-    srcp = src;
+    for (i = 0; (cnt >= 8U) && (i < 3); ++i) {
+        p = 1U << i;
 
-    while (srcp < srcz) {
-        search(src, srcp, srcz, &o[0], &l[0], x);
+        while (r->ge[i] < &srcp[8]) {
+            if (*r->ge[i] != *&r->ge[i][-(i32)p]) {
+                r->gs[i] = &r->ge[i][1 - (i32)p];
+            }
 
-        if (l[0] < 3U) {
-            bitflags |= mask;
-            vappend(bytes, srcp);
-            srcp = &srcp[1];
+            r->ge[i]++;
         }
-        else {
-            search(src, &srcp[1], srcz, &o[1], &l[1], x);
 
-            if ((l[0] + 1U) < l[1]) {
-                bitflags |= mask;
-                vappend(bytes, srcp);
-                srcp = &srcp[1];
-
-                if ((mask >>= 1) == 0) {
-                    mask = T;
-                    vappend(flags, &bitflags);
-                    bitflags = 0x00000000U;
-                }
+        if ((r->gs[i] > pos) || ((u32)(srcp - pos) < p)) {
+            continue;
+        }
 
-                l[0] = l[1];
-                o[0] = o[1];
-            }
-            
-            switch (*srcz) {
-                case 2:     /* Zelda */
-                case 3:     /* Zelda 2 */
-                    if (l[0] < 0x12U) {
-                        h = ((((u16)l[0] - 2U) * 0x1000U) | (u16)o[0]);
-                    }
-                    else {
-                        h = (u16)o[0];
-                        b = (u8)(l[0] - 0x12U);
-                        vappend(bytes, &b);
-                    }
-                    break;
-                case 4:     /* Revolution */
-                    if (l[0] < 0x11U) {
-                        h = ((((u16)l[0] - 1U) * 0x1000U) | (u16)o[0]);
-                    }
-                    else if (l[0] < 0x111U) {
-                        h = (u16)o[0];
-                        b = (u8)(l[0] - 0x11U);
-                        vappend(bytes, &b);
-                    }
-                    else {
-                        h = 0x1000 | (u16)o[0];
-                        vappend(dicts, &h);
-                        h = (u16)(l[0] - 0x111U);
-                    }
-                    break;
-                default:    /* Mario | Mario 2 */
-                    h = ((((u16)l[0] - 3U) * 0x1000U) | (u16)o[0]);
-                    break;
-            }
+        z = &srcp[cnt];
 
-            vappend(dicts, &h);
-            srcp = &srcp[l[0]];
+        while ((r->ge[i] < z) && (*r->ge[i] == *&r->ge[i][-(i32)p])) {
+            r->ge[i]++;
         }
 
-        if ((mask >>= 1) == 0) {
-            mask = T;
-            vappend(flags, &bitflags);
-            bitflags = 0x00000000U;
-        }
+        *o = ((u32)(srcp - pos) & ~(p - 1U)) - 1U;
+        *l = ((r->ge[i] < z) ? r->ge[i] : z) - srcp;
+        return 1;
     }
 
-    if (mask != T) {
-        vappend(flags, &bitflags);
-    }
+    return 0;
+}
 
-    header.m = m;
-    header.s = srcz - src;
+/*  The finder of the serial encoder: runs, then search_hash() if "f" is
+    given, else search(). */
+static void search_run(run_t *r, fnd_t *f, u8 *src, u8 *srcp, u8 *srcz,
+                       u32 *o, u32 *l, const u32 x)
+{
+    u32 vo, vl;
 
-    switch (*srcz) {
-        case 1:     /* Mario 2 */
-            header.h = header.s;
-            header.s = 0x30300000U;
-            header.b = (flags->ct << 1) + (dicts->ct << 1);
-            size = (u32)(header.b + bytes->ct + 0x10);
-            break;
-        case 3:     /* Zelda 2 */
-            header.h = 0;
-            header.b = 0;
-            size = (u32)(0x10 + flags->ct + (dicts->ct << 1) + bytes->ct);
-            break;
-        default:
-            header.h = (flags->ct << 2) + 0x10;
-            header.b = header.h + (dicts->ct << 1);
-            size = (u32)(header.b + bytes->ct);
-            break;
+    if (!search_runs(r, src, srcp, srcz, o, l, x)) {
+        if (f != NULL) {
+            search_hash(f, src, srcp, srcz, o, l, x);
+        }
+        else {
+            search(src, srcp, srcz, o, l, x);
+        }
     }
 
-    dst = (u8 *)calloc(size, sizeof(u8));
-    dstp = dst;
-    dstz = &dst[size];
+    if (verify && ((f == NULL) || (f->depth == 0))) {
+        search(src, srcp, srcz, &vo, &vl, x);
 
-    if (dst == NULL) {
-        display_error(RAM_UNAVAILABLE, NULL);
-        goto err;
+        if ((vo != *o) || (vl != *l)) {
+            printf("/// ERROR ///\n>>> Match at 0x%X is %u/0x%X,"
+                   " search() finds %u/0x%X!\n",
+                   (unsigned)(srcp - src), (unsigned)*l, (unsigned)*o,
+                   (unsigned)vl, (unsigned)vo);
+            exit(1);
+        }
     }
 
+    return;
+}
+
+/*  Where no three bytes ahead repeat within the window, such as in noise or
+    in data compressed already, no match can start either, so the parse is
+    bound to take every byte there as a literal.  bare() finds how far that
+    goes by following chains of the positions sharing a hash of their first
+    three bytes, which only ever hold a few positions in such stretches and
+    stop at the first repeat elsewhere, so they need no search at all. */
+static int skip = 0;       /* take bare() stretches as literals */
+static u32 unsearched = 0; /* bytes it did */
+
+typedef struct bare_s {
+    u32 head[1U << HASH_BITS], /* latest position + 1 of every hash */
+        prev[0x1000];          /* the one before it, by position */
+    u8 *ins;                   /* next position to be hashed */
+} bare_t;
+
+static void bare_open(bare_t *d, u8 *at)
+{
+    memset(d->head, 0, sizeof(d->head));
+    d->ins = at;
+    return;
+}
+
+/*  Returns how many positions from "srcp" on start no match. */
+static u32 bare(bare_t *d, u8 *src, u8 *srcp, u8 *srcz)
+{
+    u8 *p, *c;
+    u32 h, a;
+
+    if (d->ins > srcp) {
+        return 0;
+    }
+
+    for (p = d->ins; &p[2] < srcz; ++p) {
+        h = hash3(p);
+
+        for (a = (p >= srcp) ? d->head[h] : 0;
+             (a != 0) && ((p - (c = &src[a - 1U])) <= 0x1000);
+             a = d->prev[(a - 1U) & 0xFFF]) {
+            if ((c[0] == p[0]) && (c[1] == p[1]) && (c[2] == p[2])) {
+                break;
+            }
+        }
+
+        if ((a != 0) && ((p - c) <= 0x1000)) {
+            break;
+        }
+
+        a = (u32)(p - src);
+        d->prev[a & 0xFFF] = d->head[h];
+        d->head[h] = a + 1U;
+    }
+
+    d->ins = p;
+    return (p > srcp) ? (u32)(p - srcp) : 0;
+}
+
+
+
+/*---------------------------------------------------------------------------
+
+                           Match Pre-Pass Section
+
+---------------------------------------------------------------------------*/
+
+
+
+/*  The matches search() finds only depend on the input, so the matches at
+    every position can be found ahead of the parse by a number of threads,
+    each taking blocks of positions in turn, and the parse only waits for
+    the block it is about to read.  Every entry holds the offset of a match
+    in its low 12 bits and its length above, once per maximum length asked
+    for, exactly as search() would have found them.
+    The parse only ever asks for the positions it lands on, and the one
+    after each for its lazy step, so every thread follows the parse of
+    every maximum length through its block and finds no others, which are
+    left PRE_NONE.  The parse entering a block out of step with that, until
+    both meet again, finds the few it lands on then itself.
+    Finding the matches of many positions means the same byte pairs are
+    compared over and over inside runs; so each thread remembers, for every
+    distance, the last stretch of input known to repeat at that distance
+    and skips over it when extending a match. */
+#define PRE_BLOCK 0x4000U
+#define PRE_NONE  0xFFFFFFFFU
+
+static unsigned prepass = 1; /* threads, more than one enables the pre-pass */
+
+typedef struct pre_s {
+    u8 *src,
+       *srcz;
+    u32 *tab,     /* matches of every position, "n" apiece */
+        x[3],
+        n,
+        blocks,
+        next,     /* next block to be claimed */
+        ready;    /* blocks completed from the start */
+    u8 *done;     /* completion of every block */
+    run_t run;    /* runs of the parse, for what it finds itself */
+    unsigned nthr;
+    pthread_t *id;
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+} pre_t;
+
+/*  Extends the match at "c" of the "mm" bytes known to match at "srcp" up
+    to "cnt" bytes, skipping over what "eq" knows to repeat at its distance
+    and recording what it learns. */
+static u32 extend_pre(u8 *src, u8 *srcp, u8 *c, u32 mm, const u32 cnt,
+                      u32 (*eq)[2])
+{
+    u32 d = srcp - c, a = srcp - src;
+
+    if ((eq[d][0] <= (a + mm)) && ((a + mm) < eq[d][1])) {
+        mm = eq[d][1] - a;
+        mm = (mm < cnt) ? mm : cnt;
+    }
+
+    while ((mm < cnt) && (*&c[mm] == *&srcp[mm])) {
+        ++mm;
+    }
+
+    if ((eq[d][1] < a) || ((a + mm) < eq[d][0])) {
+        eq[d][0] = a;
+        eq[d][1] = a + mm;
+    }
+    else {
+        eq[d][0] = (eq[d][0] < a) ? eq[d][0] : a;
+        eq[d][1] = (eq[d][1] > (a + mm)) ? eq[d][1] : (a + mm);
+    }
+
+    return mm;
+}
+
+/*  Same as search_tiers() in one go, into packed entries.  Inside runs,
+    "r" answers for every maximum length first.  Once the lengths up to
+    "need" are found, the search stops, as search_tiers() does: where the
+    matches run long, finding them for the longest maximum at positions the
+    parse of a shorter one lands on costs more than all the rest, so longer
+    ones not found on the way are left as they are. */
+static void search_pre(u8 *src, u8 *srcp, u8 *srcz, u32 *t, const u32 *x,
+                       const u32 n, const u32 need, u32 (*eq)[2], run_t *r)
+{
+    u32 cnt[3], mm = 3U, i, k = 0, d;
+    u32 posp = 0;
+    u8 *pos = (((srcp - src) < 0x1001U) ? src : &srcp[~0xFFF]), *c;
+
+    for (i = 0; (i < n) && search_runs(r, src, srcp, srcz, &d, &mm, x[i]);
+         ++i) {
+        t[i] = (mm << 12) | d;
+    }
+
+    if (i == n) {
+        return;
+    }
+
+    mm = 3U;
+
+    for (i = 0; i < n; ++i) {
+        cnt[i] = srcz - srcp;
+
+        if ((x[i] - 1U) < cnt[i]) {
+            cnt[i] = x[i];
+        }
+    }
+
+    while ((k < n) && (cnt[k] < 3U)) {
+        t[k++] = 0;
+    }
+
+    if (k == n) {
+        return;
+    }
+
+    while (pos < srcp) {
+        c = &pos[mischarsearch(srcp, mm, pos, &srcp[mm] - pos)];
+
+        if (c >= srcp) {
+            break;
+        }
+
+        mm = extend_pre(src, srcp, c, mm, cnt[need], eq);
+        d = srcp - c;
+
+        while ((k < n) && (cnt[k] <= mm)) {
+            t[k] = (cnt[k] << 12) | (d - 1U);
+            ++k;
+        }
+
+        if ((k == n) || (k > need)) {
+            return;
+        }
+
+        posp = d - 1U;
+        ++mm;
+        pos = &c[1];
+    }
+
+    while (k < n) {
+        t[k] = (((mm < 4U) ? 0 : (mm - 1U)) << 12) | posp;
+        ++k;
+    }
+
+    return;
+}
+
+/*  Finds the matches at "i" unless found already, returning the length of
+    the one for the maximum length "k". */
+static u32 pre_at(pre_t *pre, const u32 i, const u32 k, u32 (*eq)[2],
+                  run_t *r)
+{
+    u32 *t = &pre->tab[i * pre->n];
+
+    if (t[k] == PRE_NONE) {
+        search_pre(pre->src, &pre->src[i], pre->srcz, t, pre->x, pre->n, k,
+                   eq, r);
+    }
+
+    return t[k] >> 12;
+}
+
+static void *pre_worker(void *arg)
+{
+    pre_t *pre = (pre_t *)arg;
+    u32 eq[0x1001][2], b, i, iz, k, l[2];
+    run_t run;
+    unsigned long long t0;
+
+    memset(eq, 0, sizeof(eq));
+
+    while (1) {
+        pthread_mutex_lock(&pre->mu);
+        b = pre->next++;
+        pthread_mutex_unlock(&pre->mu);
+
+        if (b >= pre->blocks) {
+            break;
+        }
+
+        iz = (b + 1U) * PRE_BLOCK;
+        iz = (iz < (u32)(pre->srcz - pre->src)) ? iz
+                                                : (u32)(pre->srcz - pre->src);
+        t0 = trace_now();
+        i = b * PRE_BLOCK;
+        memset(&pre->tab[i * pre->n], 0xFF, (iz - i) * pre->n * sizeof(u32));
+
+        for (k = 0; k < pre->n; ++k) {
+            i = b * PRE_BLOCK;
+            run_open(&run, &pre->src[(i < 0x1000U) ? 0 : (i - 0x1000U)]);
+
+            while (i < iz) {
+                l[0] = pre_at(pre, i, k, eq, &run);
+                l[1] = ((l[0] >= 3U) && ((i + 1U) < iz))
+                     ? pre_at(pre, i + 1U, k, eq, &run) : 0;
+
+                if ((l[0] + 1U) < l[1]) {
+                    l[0] = l[1];
+                    ++i;
+                }
+
+                i += (l[0] < 3U) ? 1U : l[0];
+            }
+        }
+
+        span("match finding", t0);
+
+        pthread_mutex_lock(&pre->mu);
+        pre->done[b] = 1;
+
+        while ((pre->ready < pre->blocks) && pre->done[pre->ready]) {
+            pre->ready++;
+        }
+
+        pthread_cond_broadcast(&pre->cv);
+        pthread_mutex_unlock(&pre->mu);
+    }
+
+    return NULL;
+}
+
+static void pre_stop(pre_t *pre)
+{
+    unsigned i;
+
+    pthread_mutex_lock(&pre->mu);
+    pre->next = pre->blocks;
+    pthread_mutex_unlock(&pre->mu);
+
+    for (i = 0; i < pre->nthr; ++i) {
+        pthread_join(pre->id[i], NULL);
+    }
+
+    pthread_cond_destroy(&pre->cv);
+    pthread_mutex_destroy(&pre->mu);
+    free(pre->id);
+    free(pre->done);
+    free(pre->tab);
+    pre->id = NULL;
+    pre->done = NULL;
+    pre->tab = NULL;
+    return;
+}
+
+/*  Starts "nthr" threads finding the matches of "src" for the "n" maximum
+    lengths of "x" (ascending order).  Returns zero on success. */
+static int pre_start(pre_t *pre, u8 *src, u8 *srcz,
+                     const u32 *x, const u32 n, const unsigned nthr)
+{
+    u32 size = srcz - src;
+
+    memset(pre, 0, sizeof(*pre));
+    pre->src = src;
+    pre->srcz = srcz;
+    pre->n = n;
+    memcpy(pre->x, x, n * sizeof(u32));
+    pre->blocks = (size + (PRE_BLOCK - 1U)) / PRE_BLOCK;
+    run_open(&pre->run, src);
+    pre->tab = (u32 *)calloc((size_t)(size + 1U) * n, sizeof(u32));
+    pre->done = (u8 *)calloc(pre->blocks + 1U, sizeof(u8));
+    pre->id = (pthread_t *)calloc(nthr, sizeof(pthread_t));
+
+    if ((pre->tab == NULL) || (pre->done == NULL) || (pre->id == NULL)) {
+        free(pre->id);
+        free(pre->done);
+        free(pre->tab);
+        return -1;
+    }
+
+    pthread_mutex_init(&pre->mu, NULL);
+    pthread_cond_init(&pre->cv, NULL);
+
+    while (pre->nthr < nthr) {
+        if (pthread_create(&pre->id[pre->nthr], NULL, pre_worker, pre) != 0) {
+            break;
+        }
+
+        pre->nthr++;
+    }
+
+    if (pre->nthr == 0) {
+        pre_stop(pre);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*  Reads the match at "srcp" for the maximum length "k" of the pre-pass,
+    waiting for its block when need be; "lim" caches how far the pre-pass
+    was complete when last asked. */
+static void pre_match(pre_t *pre, u8 *srcp, const u32 k,
+                      u32 *o, u32 *l, u8 **lim)
+{
+    u32 i = srcp - pre->src, t;
+
+    if ((srcp >= *lim) && (srcp < pre->srcz)) {
+        pthread_mutex_lock(&pre->mu);
+
+        while (pre->ready <= (i / PRE_BLOCK)) {
+            pthread_cond_wait(&pre->cv, &pre->mu);
+        }
+
+        *lim = ((pre->ready * PRE_BLOCK) < (u32)(pre->srcz - pre->src))
+             ? &pre->src[pre->ready * PRE_BLOCK] : pre->srcz;
+        pthread_mutex_unlock(&pre->mu);
+    }
+
+    if ((t = pre->tab[(i * pre->n) + k]) == PRE_NONE) {
+        search_run(&pre->run, NULL, pre->src, srcp, pre->srcz, o, l,
+                   pre->x[k]);
+        return;
+    }
+
+    *o = t & 0xFFFU;
+    *l = t >> 12;
+    return;
+}
+
+
+
+/*---------------------------------------------------------------------------
+
+                                Coding Section
+
+---------------------------------------------------------------------------*/
+
+
+
+static void assemble_tables(u8 *dstp, u8 *dstz,
+                            vec_t *flags, vec_t *dicts, vec_t *bytes)
+{
+    u32 *c = (u32 *)&dstp[0], *cz = &c[flags->ct],
+        *cmdp = flags->org, tmp;
+    u16 *p = (u16 *)&dstp[flags->ct << 2], *pz = &p[dicts->ct],
+        *polp = dicts->org;
+    u8 *defp = bytes->org;
+
     do {
-        u32 *hdr = (u32 *)&dstp[0x00], *hdrz = &hdr[4],
-            *g = (u32 *)&header;
-        u32 tmp;
+        dstp = &dstp[(flags->ct << 2) + (dicts->ct << 1)];
+
+        while (c < cz) {
+            tmp = *cmdp++;
+            strinv(&tmp, 4);
+            *c++ = tmp;
+        }
+
+        while (p < pz) {
+            tmp = *polp++;
+            strinv(&tmp, 2);
+            *p++ = tmp;
+        }
+
+        while (dstp < dstz) {
+            *dstp++ = *defp++;
+        }
+    } while (0);
+
+    return;
+}
+
+static void assemble_groups(u8 *dstp, u8 *dstz,
+                            vec_t *flags, vec_t *dicts, vec_t *bytes)
+{
+    u16 *h = (u16 *)&dstp[0], *hz = &h[flags->ct + dicts->ct],
+        *cmdp = flags->org, *polp = dicts->org, n = 0, tmp;
+    u8 *defp = bytes->org;
+    i16 f;
+
+    do {
+        while (h < hz) {
+            if (n != 0) {
+                if ((f < 0) == 0) {
+                    tmp = *polp++;
+                    strinv(&tmp, 2);
+                    *h++ = tmp;
+                }
+
+                f <<= 1;
+                --n;
+            }
+            else {
+                tmp = *cmdp++;
+                f = (i16)tmp;
+                strinv(&tmp, 2);
+                *h++ = tmp;
+                n = 16;
+            }
+        }
+
+        dstp = &dstp[(flags->ct << 1) + (dicts->ct << 1)];
+
+        while (dstp < dstz) {
+            *dstp++ = *defp++;
+        }
+    } while (0);
+
+    return;
+}
+
+static void assemble_stream(u8 *dstp, u8 *dstz,
+                            vec_t *flags, vec_t *dicts, vec_t *bytes)
+{
+    u8 *cmdp = flags->org, *defp = bytes->org, n = 0, f;
+    u16 *polp = dicts->org, tmp;
+
+    do {
+        while (dstp < dstz) {
+            if (n != 0) {
+                if ((f & 0x80) == 0) {
+                    tmp = *polp;
+                    strinv(&tmp, 2);
+                    memcpy(dstp, &tmp, 2);
+                    dstp = &dstp[2];
+
+                    if ((*polp >> 12) == 0) {
+                        *dstp++ = *defp++;
+                    }
+
+                    polp = &polp[1];
+                }
+                else {
+                    *dstp++ = *defp++;
+                }
+
+                f <<= 1;
+                --n;
+            }
+            else {
+                f = *cmdp++;
+                *dstp++ = f;
+                n = 8;
+            }
+        }
+    } while (0);
+
+    return;
+}
+
+/*  { Maximum Match Length, FourCC } per format */
+static const u32 fmtq[2][5] = { { 0x12, 0x12,
+                                  0x111, 0x111,
+                                  0x10110 },
+                                { 0x4D494F30, 0x534D5352,
+                                  0x59617930, 0x59617A30,
+                                  0x52766C30 } };
+
+typedef struct enc_s {
+    vec_t *bytes, /* Literals and extended lengths */
+          *dicts, /* Dictionary HalfWords */
+          *flags; /* Bitflags */
+    u32 mask, bitflags, T, x;
+    u8 fmt;
+    void (*match)(struct enc_s *, const u32, const u32); /* see encoders */
+} enc_t;
+
+static void enc_free(enc_t *e)
+{
+    e->bytes = vfree(e->bytes);
+    e->dicts = vfree(e->dicts);
+    e->flags = vfree(e->flags);
+    return;
+}
+
+static void enc_next(enc_t *e)
+{
+    if ((e->mask >>= 1) == 0) {
+        e->mask = e->T;
+        vappend(e->flags, &e->bitflags);
+        e->bitflags = 0x00000000U;
+    }
+
+    return;
+}
+
+static void enc_literal(enc_t *e, u8 *srcp)
+{
+    e->bitflags |= e->mask;
+    vappend(e->bytes, srcp);
+    enc_next(e);
+    return;
+}
+
+/*  One match encoder per format, "F" being the format's index, so that the
+    length tiers are constants of the kernel, picked once by enc_open().
+    The parse and the literals stay shared, reading the flag width from
+    "e", as the match search takes nearly all of an encode's time. */
+#define ENC_KERNEL(name, F)                                                   \
+static void name(enc_t *e, const u32 o, const u32 l)                          \
+{                                                                             \
+    u16 h;                                                                    \
+    u8 b;                                                                     \
+                                                                              \
+    if ((F == 2) || (F == 3)) {                 /* Zelda */                   \
+        if (l < 0x12U) {                                                      \
+            h = ((((u16)l - 2U) * 0x1000U) | (u16)o);                         \
+        }                                                                     \
+        else {                                                                \
+            h = (u16)o;                                                       \
+            b = (u8)(l - 0x12U);                                              \
+            vappend(e->bytes, &b);                                            \
+        }                                                                     \
+    }                                                                         \
+    else if (F == 4) {                          /* Revolution */              \
+        if (l < 0x11U) {                                                      \
+            h = ((((u16)l - 1U) * 0x1000U) | (u16)o);                         \
+        }                                                                     \
+        else if (l < 0x111U) {                                                \
+            h = (u16)o;                                                       \
+            b = (u8)(l - 0x11U);                                              \
+            vappend(e->bytes, &b);                                            \
+        }                                                                     \
+        else {                                                                \
+            h = 0x1000 | (u16)o;                                              \
+            vappend(e->dicts, &h);                                            \
+            h = (u16)(l - 0x111U);                                            \
+        }                                                                     \
+    }                                                                         \
+    else {                                      /* Mario */                   \
+        h = ((((u16)l - 3U) * 0x1000U) | (u16)o);                             \
+    }                                                                         \
+                                                                              \
+    vappend(e->dicts, &h);                                                    \
+    enc_next(e);                                                              \
+    return;                                                                   \
+}
+
+ENC_KERNEL(enc_mio0, 0)
+ENC_KERNEL(enc_smsr00, 1)
+ENC_KERNEL(enc_yay0, 2)
+ENC_KERNEL(enc_yaz0, 3)
+ENC_KERNEL(enc_rvl0, 4)
+
+static void (*const encoders[5])(enc_t *, const u32, const u32) = {
+    enc_mio0, enc_smsr00, enc_yay0, enc_yaz0, enc_rvl0
+};
+
+/*  The vectors of "e" are reused when not NULL. */
+static void enc_open(enc_t *e, const u8 fmt)
+{
+    e->fmt = fmt;
+    e->match = encoders[fmt];
+    e->x = fmtq[0][fmt];
+    e->bitflags = 0x00000000U;
+    e->bytes = vreuse(e->bytes, 1);
+    e->dicts = vreuse(e->dicts, 2);
+
+    switch (fmt) {
+        case 1:     /* Mario 2 */
+            e->T = 0x8000U;
+            e->flags = vreuse(e->flags, 2);
+            break;
+        case 3:     /* Zelda 2 */
+            e->T = 0x80U;
+            e->flags = vreuse(e->flags, 1);
+            break;
+        default:
+            e->T = 0x80000000U;
+            e->flags = vreuse(e->flags, 4);
+            break;
+    }
+
+    e->mask = e->T;
+    return;
+}
+
+/*  Size of an encoded block of "flags" units of bitflags, "dicts" HalfWords
+    and "bytes" bytes in the format "fmt", header included. */
+static u32 enc_size(const u8 fmt, const u32 flags, const u32 dicts,
+                    const u32 bytes)
+{
+    u32 T = (fmt == 1) ? 2U : ((fmt == 3) ? 1U : 4U);
+
+    return 0x10 + (flags * T) + (dicts << 1) + bytes;
+}
+
+/*  Flushes the pending bitflags and lays out the encoded block of "s"
+    decoded bytes, header included.  The caller frees the result. */
+static u8 *enc_close(enc_t *e, const u32 s, u32 *size)
+{
+    void (*assemble)(u8 *, u8 *, vec_t *, vec_t *, vec_t *);
+    vec_t *bytes = e->bytes, *dicts = e->dicts, *flags = e->flags;
+    u8 *dst, *dstp, *dstz;
+    hdr_t header;
+    unsigned long long t0;
+
+    if (e->mask != e->T) {
+        vappend(flags, &e->bitflags);
+        e->mask = e->T;
+        e->bitflags = 0x00000000U;
+    }
+
+    header.m = fmtq[1][e->fmt];
+    header.s = s;
+
+    switch (e->fmt) {
+        case 1:     /* Mario 2 */
+            header.h = header.s;
+            header.s = 0x30300000U;
+            header.b = (flags->ct << 1) + (dicts->ct << 1);
+            assemble = assemble_groups;
+            break;
+        case 3:     /* Zelda 2 */
+            header.h = 0;
+            header.b = 0;
+            assemble = assemble_stream;
+            break;
+        default:
+            header.h = (flags->ct << 2) + 0x10;
+            header.b = header.h + (dicts->ct << 1);
+            assemble = assemble_tables;
+            break;
+    }
+
+    *size = enc_size(e->fmt, flags->ct, dicts->ct, bytes->ct);
+
+    if ((dst = (u8 *)calloc(*size, sizeof(u8))) == NULL) {
+        display_error(RAM_UNAVAILABLE, NULL);
+        return NULL;
+    }
+
+    dstp = dst;
+    dstz = &dst[*size];
+
+    do {
+        u32 *hdr = (u32 *)&dstp[0x00], *hdrz = &hdr[4],
+            *g = (u32 *)&header;
+        u32 tmp;
+
+        while (hdr < hdrz) {
+            tmp = *g++;
+            strinv(&tmp, 4);
+            *hdr++ = tmp;
+        }
+    } while (0);
+
+    dstp = &dstp[0x10];
+    t0 = trace_now();
+    assemble(dstp, dstz, flags, dicts, bytes);
+    span("assemble", t0);
+    return dst;
+}
+
+/*  A previous input, and its encoded block from this encoder in the same
+    format, lets an edited input reuse the parse of whatever did not change.
+    The parse only ever looks at the bytes of the window and those within
+    the maximum match length ahead of it, so every step of the old parse
+    which looked no further than the first changed byte is taken as is,
+    and the parse resumes at the start of a step.  Past the changes, once
+    the parse reaches the start of an old step, the same distance from the
+    end of either input, with a whole window of unchanged bytes behind it,
+    the rest of the old parse follows as well.  Steps start after a match,
+    and after a literal followed by another literal. */
+typedef struct inc_s {
+    u8 *src,
+       *srcz,  /* previous input */
+       *enc;   /* its encoded block */
+    u32 size;
+    vec_t *tok; /* its tokens, see tokenize() */
+    u32 i;      /* next token to resume from */
+    u8 *q,      /* its position in the previous input */
+       *sfx;    /* start of the bytes unchanged up to the end */
+    int rough;  /* the block is marked as not parsed at full effort */
+} inc_t;
+
+static inc_t *previous = NULL;
+
+/*  A block not parsed at full effort, as when kept to a deadline, is
+    marked by a file named after it with ROUGH appended, which a full
+    encode to the same name removes.  Returns that name, to be freed. */
+#define ROUGH ".rough"
+
+static char *rough_name(const char *name)
+{
+    char *r;
+
+    if ((r = (char *)malloc(strlen(name) + sizeof(ROUGH))) != NULL) {
+        strcpy(r, name);
+        strcat(r, ROUGH);
+    }
+
+    return r;
+}
+
+/*  Lists the tokens of "inc" as lengths above 12 bits of offset, zero for
+    literals.  Returns zero if they make up the previous input exactly. */
+static int tokenize(inc_t *inc, const u8 fmt)
+{
+    u8 *enc = inc->enc, *encz = &enc[inc->size], *w, *h, *b, *q;
+    u32 tmp, T, n = 0, f = 0, l, d, t;
+    u16 hw;
+
+    if (inc->size < 0x10) {
+        return -1;
+    }
+
+    memcpy(&tmp, &enc[0x00], 4);
+    strinv(&tmp, 4);
+
+    if (tmp != fmtq[1][fmt]) {
+        return -1;
+    }
+
+    memcpy(&tmp, &enc[(fmt == 1) ? 0x08 : 0x04], 4);
+    strinv(&tmp, 4);
+
+    if (tmp != (u32)(inc->srcz - inc->src)) {
+        return -1;
+    }
+
+    memcpy(&tmp, &enc[0x08], 4);
+    strinv(&tmp, 4);
+    h = &enc[(fmt == 1) ? 0x10 : ((tmp < inc->size) ? tmp : inc->size)];
+    memcpy(&tmp, &enc[0x0C], 4);
+    strinv(&tmp, 4);
+    tmp += (fmt == 1) ? 0x10 : 0;
+    b = &enc[(tmp < inc->size) ? tmp : inc->size];
+    w = &enc[0x10];
+    T = (fmt == 1) ? 2 : ((fmt == 3) ? 1 : 4);
+    inc->tok = vreuse(inc->tok, 4);
+
+/*  Every cursor is checked before it's read; a block from elsewhere fails. */
+#define TAKE(p, k) if (((size_t)(encz - (p)) < (k))) { return -1; }
+
+    for (q = inc->src; q < inc->srcz; ) {
+        if (n == 0) {
+            TAKE(w, T);
+            f = 0;
+            memcpy(&f, w, T);
+            strinv(&f, T);
+            f <<= (32 - (T << 3));
+            w = &w[T];
+            n = T << 3;
+        }
+
+        if (f & 0x80000000U) {
+            u8 **c = (fmt == 3) ? &w : &b;
+
+            TAKE(*c, 1);
+
+            if (**c != *q) {
+                return -1;
+            }
+
+            *c = &(*c)[1];
+            t = 0;
+            vappend(inc->tok, &t);
+            q = &q[1];
+        }
+        else {
+            u8 **c = ((fmt == 1) || (fmt == 3)) ? &w : &h;
+
+            TAKE(*c, 2);
+            memcpy(&hw, *c, 2);
+            strinv(&hw, 2);
+            *c = &(*c)[2];
+            l = hw >> 12;
+            d = hw & 0xFFF;
+
+            switch (fmt) {
+                case 2:     /* Zelda */
+                case 3:     /* Zelda 2 */
+                    if (l == 0) {
+                        c = (fmt == 3) ? &w : &b;
+                        TAKE(*c, 1);
+                        l = (u32)**c + 18U;
+                        *c = &(*c)[1];
+                    }
+                    else {
+                        l += 2U;
+                    }
+                    break;
+                case 4:     /* Revolution */
+                    if (l == 0) {
+                        TAKE(b, 1);
+                        l = (u32)*b++ + 17U;
+                    }
+                    else if (l == 1) {
+                        TAKE(h, 2);
+                        memcpy(&hw, h, 2);
+                        strinv(&hw, 2);
+                        h = &h[2];
+                        l = (u32)hw + 273U;
+                    }
+                    else {
+                        ++l;
+                    }
+                    break;
+                default:    /* Mario | Mario 2 */
+                    l += 3U;
+                    break;
+            }
+
+            if (((u32)(q - inc->src) <= d) ||
+                ((u32)(inc->srcz - q) < l)) {
+                return -1;
+            }
+
+            for (t = 0; t < l; ++t) {
+                if (q[t] != q[(i32)t - (i32)d - 1]) {
+                    return -1;
+                }
+            }
+
+            t = (l << 12) | d;
+            vappend(inc->tok, &t);
+            q = &q[l];
+        }
+
+        f <<= 1;
+        --n;
+    }
+
+#undef TAKE
+
+    return 0;
+}
+
+static void inc_replay(inc_t *inc, enc_t *e, u8 *srcp, const u32 iz)
+{
+    u32 *tok = (u32 *)inc->tok->org;
+
+    for (; inc->i < iz; inc->i++) {
+        if (tok[inc->i] == 0) {
+            enc_literal(e, srcp);
+            srcp = &srcp[1];
+            inc->q = &inc->q[1];
+        }
+        else {
+            e->match(e, tok[inc->i] & 0xFFFU, tok[inc->i] >> 12);
+            srcp = &srcp[tok[inc->i] >> 12];
+            inc->q = &inc->q[tok[inc->i] >> 12];
+        }
+    }
+
+    return;
+}
+
+static int inc_step(inc_t *inc)
+{
+    u32 *tok = (u32 *)inc->tok->org;
+
+    return (inc->i == 0) || (tok[inc->i - 1] != 0) ||
+           ((inc->i < inc->tok->ct) && (tok[inc->i] == 0));
+}
+
+/*  A block decoding to the previous input may still come from another
+    parse, such as one kept to a deadline, which the replayed steps would
+    carry into the new block.  Blocks this encoder did not parse at full
+    effort are marked as "rough" (see rough_name()) and refused outright.
+    Any other block has the parse run again at INC_CHECKS of its steps
+    spread over it, and one of them taking other tokens than the old ones
+    refuses it too.  Given a tolerance, rough blocks and differing ones may
+    still be taken: from every sampled step, both parses are run on for
+    INC_WINDOW old tokens and up to where they meet again, and the bits the
+    old one took over the new one, taken for the whole input from the bytes
+    so covered, must stay within "tolerance" thousandths of the block. */
+#define INC_CHECKS 0x400
+#define INC_WINDOW 0x10
+#define INC_SPAN   0x100
+
+static unsigned tolerance = 0; /* per mille -p may take over a full parse */
+
+/*  Bits a token "l" long takes in the format "fmt", its flag included;
+    zero is a literal. */
+static u32 tok_bits(const u8 fmt, const u32 l)
+{
+    if (l == 0) {
+        return 9;
+    }
+
+    if (fmt == 4) {
+        return (l < 0x11U) ? 17 : ((l < 0x111U) ? 25 : 33);
+    }
+
+    return (((fmt == 2) || (fmt == 3)) && (l >= 0x12U)) ? 25 : 17;
+}
+
+/*  The step of a full parse at "q" in the previous input, as one or two
+    tokens in "t" like those of tokenize(); returns how many. */
+static u32 inc_full(inc_t *inc, run_t *r, u8 *q, const u32 x, u32 *t)
+{
+    u32 o[2], l[2];
+
+    search_run(r, NULL, inc->src, q, inc->srcz, &o[0], &l[0], x);
+
+    if (l[0] < 3U) {
+        t[0] = 0;
+        return 1;
+    }
+
+    search_run(r, NULL, inc->src, &q[1], inc->srcz, &o[1], &l[1], x);
+
+    if ((l[0] + 1U) < l[1]) {
+        t[0] = 0;
+        t[1] = (l[1] << 12) | o[1];
+        return 2;
+    }
+
+    t[0] = (l[0] << 12) | o[0];
+    return 1;
+}
+
+/*  Returns zero if the sampled steps of "inc" all matched a full parse,
+    one if it is taken within the tolerance all the same, else -1. */
+static int inc_check(inc_t *inc, const enc_t *e)
+{
+    u32 *tok = (u32 *)inc->tok->org, ct = inc->tok->ct, i, j, k, m, n,
+        next = 0, t[2];
+    u8 *q = inc->src, *pn, *po;
+    long long over = 0; /* bits the old parse took over the full one */
+    unsigned long long cover = 0;
+    run_t run;
+    int diff = inc->rough;
+
+    if (diff && (tolerance == 0)) {
+        return -1;
+    }
+
+    run_open(&run, inc->src);
+
+    for (i = 0; i < ct; q = &q[(tok[i] == 0) ? 1U : (tok[i] >> 12)], ++i) {
+        inc->i = i;
+
+        if ((i < next) || !inc_step(inc)) {
+            continue;
+        }
+
+        next = i + (ct / INC_CHECKS) + 1U;
+        n = inc_full(inc, &run, q, e->x, t);
+
+        if ((tok[i] != t[0]) ||
+            ((n == 2) && (((i + 1U) >= ct) || (tok[i + 1U] != t[1])))) {
+            if (tolerance == 0) {
+                inc->i = 0;
+                return -1;
+            }
+
+            diff = 1;
+        }
+
+        if (tolerance == 0) {
+            continue;
+        }
+
+        for (pn = po = q, j = i, k = 0;
+             (k < INC_SPAN) && ((pn != po) || ((j - i) < INC_WINDOW));
+             ++k) {
+            if (pn <= po) {
+                for (n = inc_full(inc, &run, pn, e->x, t), m = 0; m < n;
+                     ++m) {
+                    over -= tok_bits(e->fmt, t[m] >> 12);
+                    pn = &pn[(t[m] == 0) ? 1U : (t[m] >> 12)];
+                }
+            }
+            else if (j < ct) {
+                over += tok_bits(e->fmt, tok[j] >> 12);
+                po = &po[(tok[j] == 0) ? 1U : (tok[j] >> 12)];
+                j++;
+            }
+            else {
+                break;
+            }
+        }
+
+        cover += ((pn < po) ? pn : po) - q;
+    }
+
+    inc->i = 0;
+
+    if (!diff && (over == 0)) {
+        return 0;
+    }
+
+    if ((over > 0) && (cover != 0) &&
+        ((unsigned long long)over * (u32)(inc->srcz - inc->src) / cover /
+         8U * 1000U > (unsigned long long)tolerance * inc->size)) {
+        return -1;
+    }
+
+    return 1;
+}
+
+/*  Takes the old steps which only looked at unchanged bytes; returns the
+    position the parse resumes from. */
+static u8 *inc_prefix(inc_t *inc, enc_t *e, u8 *src, u8 *srcz)
+{
+    u32 *tok = (u32 *)inc->tok->org, i, iz = 0, d = 0, s = 0;
+    u8 *q = inc->src, *qz = inc->src;
+
+    while ((&src[d] < srcz) && (&inc->src[d] < inc->srcz) &&
+           (src[d] == inc->src[d])) {
+        ++d;
+    }
+
+    while ((s < (u32)(srcz - src)) && (s < (u32)(inc->srcz - inc->src)) &&
+           (srcz[-1 - (i32)s] == inc->srcz[-1 - (i32)s])) {
+        ++s;
+    }
+
+    inc->sfx = &srcz[-(i32)s];
+
+    for (i = 0; (i < inc->tok->ct) && ((u32)(q - inc->src) + e->x <= d); ) {
+        inc->i = i;
+
+        if (inc_step(inc)) {
+            iz = i;
+            qz = q;
+        }
+
+        q = &q[(tok[i] == 0) ? 1U : (tok[i] >> 12)];
+        ++i;
+    }
+
+    inc->i = 0;
+    inc->q = inc->src;
+    inc_replay(inc, e, src, iz);
+    return &src[qz - inc->src];
+}
+
+/*  Takes the rest of the old steps if the parse at "srcp" can join them;
+    returns whether it did. */
+static int inc_suffix(inc_t *inc, enc_t *e, u8 *src, u8 *srcp, u8 *srcz)
+{
+    u32 *tok = (u32 *)inc->tok->org;
+    u8 *q = &inc->srcz[-(i32)(srcz - srcp)];
+
+    if (((srcp - src) < 0x1000) || ((q - inc->src) < 0x1000) ||
+        (&srcp[-0x1000] < inc->sfx)) {
+        return 0;
+    }
+
+    while ((inc->q < q) && (inc->i < inc->tok->ct)) {
+        inc->q = &inc->q[(tok[inc->i] == 0) ? 1U : (tok[inc->i] >> 12)];
+        inc->i++;
+    }
+
+    if ((inc->q != q) || !inc_step(inc)) {
+        return 0;
+    }
+
+    inc_replay(inc, e, srcp, inc->tok->ct);
+    return 1;
+}
+
+/*  An encode given a deadline starts out as thorough as the hash chains
+    make it, then checks its pace every DUE_STEP bytes: when the rest of the
+    input would take more than three quarters of the time left at the pace
+    of the last stretch, it takes the next effort down, and when it would
+    take less than half of it, the next one up.  Efforts set how many of
+    the nearest candidates of a chain are searched, zero for all, and
+    whether a match is weighed against the next position's; the last one
+    searches nothing, so that any deadline can be kept. */
+#define DUE_STEP 0x400
+#define EFFORTS  6
+
+static const u32 effort[EFFORTS][2] = {
+    { 0, 1 }, { 0x40, 1 }, { 0x10, 1 }, { 4, 0 }, { 1, 0 }, { 0, 0 }
+};
+
+static unsigned deadline = 0; /* milliseconds an encode may take, or zero */
+static int rough = 0;         /* the last encode fell short of a full parse */
+
+typedef struct due_s {
+    unsigned long long end, /* deadline, in microseconds */
+                       t;   /* start of the stretch */
+    u32 p,                  /* position at the start of the stretch */
+        lv;                 /* effort */
+} due_t;
+
+static void due_open(due_t *d, const u32 p)
+{
+    d->t = clock_us();
+    d->end = d->t + (unsigned long long)deadline * 1000ULL;
+    d->p = p;
+    d->lv = 0;
+    return;
+}
+
+static void due_step(due_t *d, const u32 p, const u32 left)
+{
+    unsigned long long now = clock_us(), room, need;
+
+    room = (d->end > now) ? (d->end - now) : 0;
+    need = (now - d->t) * left / (p - d->p);
+
+    if (((need * 4U) > (room * 3U)) && (d->lv < (EFFORTS - 1))) {
+        ++d->lv;
+    }
+    else if (((need * 2U) < room) && (d->lv != 0)) {
+        --d->lv;
+    }
+
+    d->t = now;
+    d->p = p;
+    return;
+}
+
+static void encode_with(enc_t *e, u8 *src, u8 *srcz, FILE *ofile)
+{
+    pre_t pre;
+    run_t run;
+    due_t due;
+    fnd_t *fnd = NULL;
+    bare_t *bz = NULL;
+    inc_t *inc = NULL;
+    u8 *srcp, *dst, *lim = src;
+    u32 o[2], l[2], size, k;
+    int pp, c;
+    unsigned long long t0 = trace_now();
+
+    enc_open(e, *srcz);
+    srcp = src;
+    rough = 0;
+
+    if ((previous != NULL) && (tokenize(previous, e->fmt) == 0) &&
+        ((c = inc_check(previous, e)) >= 0)) {
+        rough = c;
+        inc = previous;
+        srcp = inc_prefix(inc, e, src, srcz);
+    }
+
+    run_open(&run, ((srcp - src) < 0x1000) ? src : &srcp[-0x1000]);
+
+    if ((fast || deadline) &&
+        ((fnd = (fnd_t *)malloc(sizeof(fnd_t))) != NULL)) {
+        fnd_open(fnd, ((srcp - src) < 0x1000) ? src : &srcp[-0x1000]);
+    }
+
+    if (skip && ((bz = (bare_t *)malloc(sizeof(bare_t))) != NULL)) {
+        bare_open(bz, ((srcp - src) < 0x1000) ? src : &srcp[-0x1000]);
+    }
+
+    due_open(&due, srcp - src);
+    pp = (inc == NULL) && (deadline == 0) && (prepass > 1) &&
+         (pre_start(&pre, src, srcz, &e->x, 1, prepass) == 0);
+
+    while (srcp < srcz) {
+        if ((inc != NULL) && inc_suffix(inc, e, src, srcp, srcz)) {
+            break;
+        }
+
+        if (deadline && ((u32)(srcp - src) >= (due.p + DUE_STEP))) {
+            due_step(&due, srcp - src, srcz - srcp);
+            rough |= (due.lv != 0);
+
+            if (fnd != NULL) {
+                fnd->depth = effort[due.lv][0];
+            }
+        }
+
+        if (due.lv == (EFFORTS - 1)) {
+            enc_literal(e, srcp);
+            srcp = &srcp[1];
+            continue;
+        }
+
+        if (pp) {
+            pre_match(&pre, srcp, 0, &o[0], &l[0], &lim);
+        }
+        else {
+            search_run(&run, fnd, src, srcp, srcz, &o[0], &l[0], e->x);
+        }
+
+        if (l[0] < 3U) {
+            enc_literal(e, srcp);
+            srcp = &srcp[1];
+
+            for (k = (bz != NULL) ? bare(bz, src, srcp, srcz) : 0; k; --k) {
+                enc_literal(e, srcp);
+                srcp = &srcp[1];
+                unsearched++;
+            }
+        }
+        else {
+            if (pp) {
+                pre_match(&pre, &srcp[1], 0, &o[1], &l[1], &lim);
+            }
+            else if (effort[due.lv][1]) {
+                search_run(&run, fnd, src, &srcp[1], srcz,
+                           &o[1], &l[1], e->x);
+            }
+            else {
+                l[1] = 0;
+            }
+
+            if ((l[0] + 1U) < l[1]) {
+                enc_literal(e, srcp);
+                srcp = &srcp[1];
+                l[0] = l[1];
+                o[0] = o[1];
+            }
+
+            e->match(e, o[0], l[0]);
+            srcp = &srcp[l[0]];
+        }
+    }
+
+    if (pp) {
+        pre_stop(&pre);
+    }
+
+    free(fnd);
+    fnd = NULL;
+    free(bz);
+    bz = NULL;
+    span("parse", t0);
+
+    if ((dst = enc_close(e, srcz - src, &size)) != NULL) {
+        t0 = trace_now();
+        fwrite(dst, sizeof(u8), size, ofile);
+        fflush(ofile);
+        span("write", t0);
+        free(dst);
+        dst = NULL;
+    }
+
+    return;
+}
+
+static void encode(u8 *src, u8 *srcz, FILE *ofile)
+{
+    enc_t e;
+
+    memset(&e, 0, sizeof(e));
+    encode_with(&e, src, srcz, ofile);
+    enc_free(&e);
+    return;
+}
+
+
+
+/*  Leading one bits of a byte: the literals in a row a flag byte opens. */
+static const u8 litrun[0x100] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 7, 8
+};
+
+/*  One decoder per format, "F" being the format's index, so that the flag
+    width, the length tiers and the layout of the streams are all constants
+    of the kernel, picked once per block by decode_with().  Kernels with "S"
+    set check the encoded block as well, returning BAD_ENCODING rather than
+    reading or writing out of bounds. */
+#define DEC_KERNEL(name, F, S)                                                \
+static int name(u8 *src, u8 *srcz, u8 *dst, u8 *dstz)                         \
+{                                                                             \
+    const u32 T = (F == 1) ? 2U : ((F == 3) ? 1U : 4U), t = T << 3,           \
+              mw = (F == 1) ? 2U : ((F == 3) ? 3U : 0),                       \
+              mh = (F == 4) ? 4U : (((F == 1) || (F == 3)) ? 0 : 2U),         \
+              mb = (F == 3) ? 0 : 1U,                                         \
+              mo = (F == 4) ? 0x10110U : ((F > 1) ? 0x111U : 0x12U);          \
+    u8 *srcp = &src[0x10], *dstp = dst, *w = &src[0x10], *h, *b, **lit,       \
+       *wz = srcz, *hz = srcz, *bz = srcz, **litz;                            \
+    i32 f = 0;                                                                \
+    u32 n = 0, tmp, k, g, hs, bs, wide = !S;                                  \
+                                                                              \
+    memcpy(&hs, &src[0x08], 4);                                               \
+    strinv(&hs, 4);                                                           \
+    memcpy(&bs, &src[0x0C], 4);                                               \
+    strinv(&bs, 4);                                                           \
+    bs += (F == 1) ? 0x10 : 0;                                                \
+                                                                              \
+    if (S && (F != 3) && ((bs < 0x10) || (bs > (u32)(srcz - src)) ||         \
+                          ((F != 1) && ((hs < 0x10) || (hs > bs))))) {        \
+        return BAD_ENCODING;                                                  \
+    }                                                                         \
+                                                                              \
+    h = ((F == 1) || (F == 3)) ? w : &src[hs];                                \
+    b = &src[bs];                                                             \
+    lit = (F == 3) ? &w : &b;                                                 \
+    litz = (F == 3) ? &wz : &bz;                                              \
+                                                                              \
+    if (F == 1) {                                                             \
+        wz = b;                                                               \
+    }                                                                         \
+    else if (F != 3) {                                                        \
+        wz = h;                                                               \
+        hz = b;                                                               \
+    }                                                                         \
+                                                                              \
+    do {                                                                      \
+        if (n == 0) {                                                         \
+            if (S && ((u32)(wz - w) < T)) {                                   \
+                return BAD_ENCODING;                                          \
+            }                                                                 \
+                                                                              \
+            memcpy(&f, w, T);                                                 \
+            w = &w[T];                                                        \
+            strinv(&f, T);                                                    \
+            f <<= (32 - (T << 3));                                            \
+            n = t;                                                            \
+            srcp = &srcp[T];                                                  \
+                                                                              \
+            /*  Checks are only made within the groups of flags any of        \
+                which could run past the end of a stream or of the output,    \
+                or before the start of the output. */                         \
+            wide = !S || (((u32)(dstp - dst) >= 0x1000U) &&                   \
+                          ((u32)(wz - w) >= t * mw) &&                        \
+                          ((u32)(hz - h) >= t * mh) &&                        \
+                          ((u32)(bz - b) >= t * mb) &&                        \
+                          ((u32)(dstz - dstp) >= t * mo));                    \
+        }                                                                     \
+        else if ((f < 0) == 0) {                                              \
+            u16 d;                                                            \
+            u32 l;                                                            \
+            u8 *p;                                                            \
+                                                                              \
+            if ((F == 1) || (F == 3)) {                                       \
+                if (!wide && ((u32)(wz - w) < 2U)) {                          \
+                    return BAD_ENCODING;                                      \
+                }                                                             \
+                                                                              \
+                memcpy(&d, w, 2);                                             \
+                w = &w[2];                                                    \
+            }                                                                 \
+            else {                                                            \
+                if (!wide && ((u32)(hz - h) < 2U)) {                          \
+                    return BAD_ENCODING;                                      \
+                }                                                             \
+                                                                              \
+                memcpy(&d, h, 2);                                             \
+                h = &h[2];                                                    \
+            }                                                                 \
+                                                                              \
+            strinv(&d, 2);                                                    \
+            l = d >> 12;                                                      \
+            d &= 0xFFF;                                                       \
+            srcp = &srcp[2];                                                  \
+                                                                              \
+            if ((F == 2) || (F == 3)) {         /* Zelda */                   \
+                if (l == 0) {                                                 \
+                    if (!wide && (*lit == *litz)) {                           \
+                        return BAD_ENCODING;                                  \
+                    }                                                         \
+                                                                              \
+                    l = (u32)*(*lit)++;                                       \
+                    l += 18U;                                                 \
+                    srcp = &srcp[1];                                          \
+                }                                                             \
+                else {                                                        \
+                    l += 2U;                                                  \
+                }                                                             \
+            }                                                                 \
+            else if (F == 4) {                  /* Revolution */              \
+                if (l == 0) {                                                 \
+                    if (!wide && (b == bz)) {                                 \
+                        return BAD_ENCODING;                                  \
+                    }                                                         \
+                                                                              \
+                    l = (u32)*b++;                                            \
+                    l += 17U;                                                 \
+                    srcp = &srcp[1];                                          \
+                }                                                             \
+                else if (l == 1) {                                            \
+                    if (!wide && ((u32)(hz - h) < 2U)) {                      \
+                        return BAD_ENCODING;                                  \
+                    }                                                         \
+                                                                              \
+                    memcpy(&l, h, 2);                                         \
+                    h = &h[2];                                                \
+                    strinv(&l, 2);                                            \
+                    l += 273U;                                                \
+                    srcp = &srcp[2];                                          \
+                }                                                             \
+                else {                                                        \
+                    ++l;                                                      \
+                }                                                             \
+            }                                                                 \
+            else {                              /* Mario */                   \
+                l += 3U;                                                      \
+            }                                                                 \
+                                                                              \
+            if (!wide && (((u32)(dstp - dst) <= d) ||                         \
+                          ((u32)(dstz - dstp) < l))) {                        \
+                return BAD_ENCODING;                                          \
+            }                                                                 \
+                                                                              \
+            /*  A match reaching back one byte is a run of it, and one not    \
+                overlapping itself a plain copy. */                           \
+            p = &dstp[~d];                                                    \
+                                                                              \
+            if (d == 0) {                                                     \
+                memset(dstp, *p, l);                                          \
+                dstp = &dstp[l];                                              \
+            }                                                                 \
+            else if (d >= l) {                                                \
+                memcpy(dstp, p, l);                                           \
+                dstp = &dstp[l];                                              \
+            }                                                                 \
+            else {                                                            \
+                do {                                                          \
+                    *dstp++ = *p++;                                           \
+                } while (--l);                                                \
+            }                                                                 \
+                                                                              \
+            f <<= 1;                                                          \
+            --n;                                                              \
+        }                                                                     \
+        else {                                                                \
+            /*  Every literal in a row is copied at once, up to the end       \
+                of either side as one by one. */                              \
+            for (k = 0, g = (u32)f; (tmp = litrun[g >> 24]) == 8U; ) {        \
+                k += 8U;                                                      \
+                g <<= 8;                                                      \
+                                                                              \
+                if (k == 32U) {                                               \
+                    break;                                                    \
+                }                                                             \
+            }                                                                 \
+                                                                              \
+            k += (k < 32U) ? tmp : 0;                                         \
+                                                                              \
+            if ((u32)(dstz - dstp) < k) {                                     \
+                k = dstz - dstp;                                              \
+            }                                                                 \
+                                                                              \
+            if ((u32)(srcz - srcp) < k) {                                     \
+                k = srcz - srcp;                                              \
+            }                                                                 \
+                                                                              \
+            if (!wide && ((u32)(*litz - *lit) < k)) {                         \
+                return BAD_ENCODING;                                          \
+            }                                                                 \
+                                                                              \
+            memcpy(dstp, *lit, k);                                            \
+            dstp = &dstp[k];                                                  \
+            *lit = &(*lit)[k];                                                \
+            srcp = &srcp[k];                                                  \
+            f <<= (k - 1U);                                                   \
+            f <<= 1;                                                          \
+            n -= k;                                                           \
+        }                                                                     \
+    } while ((dstp < dstz) && (srcp < srcz));                                 \
+                                                                              \
+    return (S && (dstp != dstz)) ? BAD_ENCODING : 0;                          \
+}
+
+DEC_KERNEL(decode_mio0, 0, 0)
+DEC_KERNEL(decode_smsr00, 1, 0)
+DEC_KERNEL(decode_yay0, 2, 0)
+DEC_KERNEL(decode_yaz0, 3, 0)
+DEC_KERNEL(decode_rvl0, 4, 0)
+DEC_KERNEL(check_mio0, 0, 1)
+DEC_KERNEL(check_smsr00, 1, 1)
+DEC_KERNEL(check_yay0, 2, 1)
+DEC_KERNEL(check_yaz0, 3, 1)
+DEC_KERNEL(check_rvl0, 4, 1)
+
+static int (*const decoders[2][5])(u8 *, u8 *, u8 *, u8 *) = {
+    { decode_mio0, decode_smsr00, decode_yay0, decode_yaz0, decode_rvl0 },
+    { check_mio0, check_smsr00, check_yay0, check_yaz0, check_rvl0 }
+};
+
+static int untrusted = 0; /* check every block decode() is given */
+
+/*  Most bytes decoded per byte of a block after its header, per format:
+    its longest match for its halfword and length bytes. */
+static const u32 fmtgrow[5] = { 9, 9, 91, 91, 0x4045 };
+
+/*  Decodes "src" to "ofile", checking it first if "safe".  Returns zero, or
+    an error code for display_error(). */
+static int decode_with(u8 *src, u8 *srcz, FILE *ofile, const int safe)
+{
+    u8 *dst;
+    u32 tmp;
+    int err;
+    unsigned long long t0;
+
+    if (safe) {
+        if ((srcz - src) < 0x10) {
+            return BAD_ENCODING;
+        }
+
+        memcpy(&tmp, src, 4);
+        strinv(&tmp, 4);
+
+        if (tmp != fmtq[1][*srcz]) {
+            return BAD_ENCODING;
+        }
+    }
+
+    memcpy(&tmp, &src[(*srcz == 1) ? 0x08 : 0x04], 4);
+    strinv(&tmp, 4);
+
+    if (safe && ((tmp == 0) || (tmp >= 0x3FFFFFFF) ||
+                 (tmp > (unsigned long long)(srcz - src - 0x10) *
+                        fmtgrow[*srcz]))) {
+        return BAD_ENCODING;
+    }
+
+    if ((dst = (u8 *)calloc(tmp, sizeof(u8))) == NULL) {
+        return RAM_UNAVAILABLE;
+    }
+
+    t0 = trace_now();
+    err = decoders[safe != 0][*srcz](src, srcz, dst, &dst[tmp]);
+    span("decode", t0);
+
+    if (err == 0) {
+        t0 = trace_now();
+        fwrite(dst, sizeof(u8), tmp, ofile);
+        fflush(ofile);
+        span("write", t0);
+    }
+
+    free(dst);
+    dst = NULL;
+    return err;
+}
+
+static void decode(u8 *src, u8 *srcz, FILE *ofile)
+{
+    int err;
+
+    if ((err = decode_with(src, srcz, ofile, untrusted)) != 0) {
+        display_error(err, NULL);
+    }
+
+    return;
+}
+
+/*---------------------------------------------------------------------------
+
+                            Multi-Format Section
+
+---------------------------------------------------------------------------*/
+
+
+
+/*  The five formats only differ in three maximum match lengths, so the
+    formats sharing one also share one parse.  The candidates search() visits
+    are the same for every length until one of them extends as far as a
+    length, which is exactly where search() returns for it; so the results
+    for all three lengths come from a single search that is suspended at a
+    length and resumed once a longer one is asked for.  Every parse reads its
+    matches from a ring of these searches, and parses are stepped from the
+    rearmost one, so none of them are more than a match length apart. */
+#define TIER_RING 0x20000U
+
+typedef struct tier_s {
+    u8 *p,    /* position tag */
+       *pos;  /* search() state */
+    u32 mm, ms, posp,
+        k,    /* count of resolved lengths */
+        c;    /* candidate at "pos[ms]" is suspended */
+    u32 o[3],
+        l[3];
+} tier_t;
+
+static void search_tiers(u8 *src, u8 *srcp, u8 *srcz, tier_t *t,
+                         const u32 *x, const u32 n, const u32 need)
+{
+    u32 cnt[3], i;
+
+    for (i = 0; i < n; ++i) {
+        cnt[i] = srcz - srcp;
+
+        if ((x[i] - 1U) < cnt[i]) {
+            cnt[i] = x[i];
+        }
+    }
+
+    if (t->p != srcp) {
+        t->p = srcp;
+        t->pos = (((srcp - src) < 0x1001U) ? src : &srcp[~0xFFF]);
+        t->mm = 3U;
+        t->posp = 0;
+        t->k = 0;
+        t->c = 0;
+
+        while ((t->k < n) && (cnt[t->k] < 3U)) {
+            t->l[t->k] = 0;
+            t->o[t->k] = 0;
+            t->k++;
+        }
+    }
+
+    while (t->k <= need) {
+        if (t->c == 0) {
+            if ((t->pos >= srcp) ||
+                (t->ms = mischarsearch(srcp, t->mm, t->pos,
+                                       &srcp[t->mm] - t->pos),
+                 t->ms >= (u32)(srcp - t->pos))) {
+                while (t->k < n) {
+                    t->o[t->k] = t->posp;
+                    t->l[t->k] = (t->mm < 4U) ? 0 : (t->mm - 1U);
+                    t->k++;
+                }
+
+                break;
+            }
+
+            t->c = 1;
+        }
+
+        while ((t->mm < cnt[need]) &&
+               (*&t->pos[t->mm + t->ms] == *&srcp[t->mm])) {
+            t->mm++;
+        }
+
+        while ((t->k < n) && (cnt[t->k] <= t->mm)) {
+            t->o[t->k] = &srcp[-1] - &t->pos[t->ms];
+            t->l[t->k] = cnt[t->k];
+            t->k++;
+        }
+
+        if (t->k > need) {
+            break;
+        }
+
+        t->posp = &srcp[-1] - &t->pos[t->ms];
+        t->mm++;
+        t->pos += (t->ms + 1U);
+        t->c = 0;
+    }
+
+    return;
+}
+
+/*  The entry of "srcp" in "ring", found up to the maximum length "need";
+    inside runs, "r" answers for every maximum length at once. */
+static tier_t *search_ring(tier_t *ring, run_t *r, u8 *src, u8 *srcp,
+                           u8 *srcz, const u32 *x, const u32 n,
+                           const u32 need)
+{
+    tier_t *t = &ring[(u32)(srcp - src) & (TIER_RING - 1U)];
+    u32 i;
+
+    if (t->p != srcp) {
+        for (i = 0; (i < n) &&
+                    search_runs(r, src, srcp, srcz, &t->o[i], &t->l[i], x[i]);
+             ++i);
+
+        if (i == n) {
+            t->p = srcp;
+            t->k = n;
+            return t;
+        }
+    }
+
+    if ((t->p != srcp) || (t->k <= need)) {
+        search_tiers(src, srcp, srcz, t, x, n, need);
+    }
+
+    return t;
+}
+
+/*  Encodes "src" once for every format flagged in "want" (bit n for the
+    format n of "*srcz"), storing each encoded block in "dst" and its size
+    in "size".  Returns the format of the smallest block. */
+static u8 encode_formats(u8 *src, u8 *srcz, const u32 want,
+                         u8 *dst[5], u32 size[5])
+{
+    enc_t e[5];
+    tier_t *ring = NULL, *t;
+    run_t run;
+    pre_t pre;
+    u8 *srcp[3], *lim = src, best = 5;
+    u32 x[3], fmts[3], o[2], l[2], n = 0, i, j, k;
+    int pp;
+    unsigned long long t0 = trace_now();
+
+    memset(e, 0, sizeof(e));
+
+    for (i = 0; i < 5; ++i) {
+        dst[i] = NULL;
+        size[i] = 0;
+
+        if ((want >> i) & 1) {
+            enc_open(&e[i], i);
+
+            if ((n == 0) || (x[n - 1] != e[i].x)) {
+                x[n] = e[i].x;
+                fmts[n] = 0;
+                srcp[n] = src;
+                ++n;
+            }
+
+            fmts[n - 1] |= 1U << i;
+        }
+    }
+
+    pp = (prepass > 1) && (pre_start(&pre, src, srcz, x, n, prepass) == 0);
+    run_open(&run, src);
+
+    if (!pp && ((ring = (tier_t *)calloc(TIER_RING, sizeof(tier_t))) == NULL)) {
+        display_error(RAM_UNAVAILABLE, NULL);
+        goto err;
+    }
+
+    do {
+        for (k = n, i = 0; i < n; ++i) {
+            if ((srcp[i] < srcz) && ((k == n) || (srcp[i] < srcp[k]))) {
+                k = i;
+            }
+        }
+
+        if (k == n) {
+            break;
+        }
+
+        if (pp) {
+            pre_match(&pre, srcp[k], k, &o[0], &l[0], &lim);
+        }
+        else {
+            t = search_ring(ring, &run, src, srcp[k], srcz, x, n, k);
+            o[0] = t->o[k];
+            l[0] = t->l[k];
+        }
+
+        if (l[0] < 3U) {
+            for (j = 0; j < 5; ++j) {
+                if ((fmts[k] >> j) & 1) {
+                    enc_literal(&e[j], srcp[k]);
+                }
+            }
+
+            srcp[k] = &srcp[k][1];
+            continue;
+        }
+
+        if (pp) {
+            pre_match(&pre, &srcp[k][1], k, &o[1], &l[1], &lim);
+        }
+        else {
+            t = search_ring(ring, &run, src, &srcp[k][1], srcz, x, n, k);
+            o[1] = t->o[k];
+            l[1] = t->l[k];
+        }
+
+        if ((l[0] + 1U) < l[1]) {
+            for (j = 0; j < 5; ++j) {
+                if ((fmts[k] >> j) & 1) {
+                    enc_literal(&e[j], srcp[k]);
+                }
+            }
+
+            srcp[k] = &srcp[k][1];
+            l[0] = l[1];
+            o[0] = o[1];
+        }
+
+        for (j = 0; j < 5; ++j) {
+            if ((fmts[k] >> j) & 1) {
+                e[j].match(&e[j], o[0], l[0]);
+            }
+        }
+
+        srcp[k] = &srcp[k][l[0]];
+    } while (1);
+
+    span("parse", t0);
+
+    for (i = 0; i < 5; ++i) {
+        if ((want >> i) & 1) {
+            dst[i] = enc_close(&e[i], srcz - src, &size[i]);
+
+            if ((dst[i] != NULL) && ((best == 5) || (size[i] < size[best]))) {
+                best = i;
+            }
+        }
+    }
+
+    if (pp) {
+        pre_stop(&pre);
+    }
+
+    free(ring);
+    ring = NULL;
+
+err:
+
+    for (i = 0; i < 5; ++i) {
+        if ((want >> i) & 1) {
+            enc_free(&e[i]);
+        }
+    }
+
+    return best;
+}
+
+/*---------------------------------------------------------------------------
+
+                              Estimate Section
+
+---------------------------------------------------------------------------*/
+
+
+
+/*  estimate() predicts the sizes of the blocks encode_formats() would give
+    for the formats of "want", far faster: matches are found in the runs and
+    the nearest EST_DEPTH candidates of the hash chains, parsed lazily as
+    encode() does, and only counted into the vectors of every format, sized
+    by enc_size().  Inputs of up to EST_BLOCK bytes are parsed with whole
+    chains instead, which is exact.  Larger inputs are only parsed over
+    EST_BLOCKS blocks spread evenly across them, each with the window of
+    bytes before it, and their mean size per byte is scaled to the whole
+    input.  Up to EST_FULL bytes, the blocks together make up one part in
+    EST_SHARE of the input, but no less than EST_BLOCKS times EST_MIN
+    bytes, and are parsed with whole chains.  Past it, they are EST_BLOCK
+    bytes long and shallow; EST_BLOCKS slices of EST_SLICE bytes, spread
+    the same way, are parsed both shallow and with whole chains, and what
+    the latter find beyond the former scales the estimate down, the
+    shallow estimate being the upper bound.  The bounds further allow for
+    twice the standard error of the mean, for the rest of the input gaining
+    up to EST_GAIN percent more than the slices, and for the EST_CUT bytes
+    a match cut at the end of each block may have cost. */
+#define EST_BLOCK  0x4000
+#define EST_BLOCKS 16
+#define EST_FULL   (EST_BLOCK * EST_BLOCKS * 2)
+#define EST_SHARE  16
+#define EST_MIN    0x100
+#define EST_SLICE  0x400
+#define EST_DEPTH  8
+#define EST_GAIN   8
+#define EST_CUT    4
+
+static double root(const double v)
+{
+    double r = (v > 1.0) ? v : 1.0;
+    int i;
+
+    for (i = 0; (i < 64) && (v > 0); ++i) {
+        r = (r + (v / r)) * 0.5;
+    }
+
+    return (v > 0) ? r : 0;
+}
+
+/*  Parses "bs" up to "be" into the "k" vectors of "e", which share one cap,
+    counting their tokens into "n", and stores the bytes each of them grew
+    per byte parsed into "r". */
+static void est_parse(enc_t *e, u32 *n, const u32 k, fnd_t *f, u8 *src,
+                      u8 *bs, u8 *be, u8 *srcz, const u32 depth, double *r)
+{
+    run_t run;
+    u8 *srcp, *at = ((bs - src) < 0x1000) ? src : &bs[-0x1000];
+    u32 o[2], l[2], c[5][3], i, lit;
+
+    fnd_open(f, at);
+    f->depth = depth;
+    run_seek(&run, at, bs);
+
+    for (i = 0; i < k; ++i) {
+        c[i][0] = n[i];
+        c[i][1] = e[i].dicts->ct;
+        c[i][2] = e[i].bytes->ct;
+    }
+
+    for (srcp = bs; srcp < be; ) {
+        search_run(&run, f, src, srcp, srcz, &o[0], &l[0], e->x);
+        lit = 0;
+
+        if (l[0] >= 3U) {
+            search_run(&run, f, src, &srcp[1], srcz, &o[1], &l[1], e->x);
+
+            if ((l[0] + 1U) < l[1]) {
+                lit = 1;
+                l[0] = l[1];
+                o[0] = o[1];
+            }
+        }
+
+        for (i = 0; i < k; ++i) {
+            if (lit || (l[0] < 3U)) {
+                enc_literal(&e[i], srcp);
+                n[i]++;
+            }
+
+            if (l[0] >= 3U) {
+                e[i].match(&e[i], o[0], l[0]);
+                n[i]++;
+            }
+        }
+
+        srcp = &srcp[lit + ((l[0] < 3U) ? 1U : l[0])];
+    }
+
+    for (i = 0; i < k; ++i) {
+        r[i] = ((double)(n[i] - c[i][0]) / 8.0 +
+                (double)(e[i].dicts->ct - c[i][1]) * 2.0 +
+                (double)(e[i].bytes->ct - c[i][2])) / (double)(be - bs);
+    }
+
+    return;
+}
+
+/*  Fills "est" with the estimate, then the lower and upper bounds, of the
+    size of every format of "want".  Returns zero on success. */
+static int estimate(u8 *src, u8 *srcz, const u32 want, u32 est[5][3])
+{
+    enc_t e[5], deep;
+    fnd_t *fnd;
+    u8 *bs;
+    u32 size = srcz - src, nb, bl, b, i, j, k, n[5], dn, dp;
+    double s[5], q[5], g[5], r[5], d[2], m, hw;
+
+    if ((fnd = (fnd_t *)malloc(sizeof(fnd_t))) == NULL) {
+        return RAM_UNAVAILABLE;
+    }
+
+    memset(e, 0, sizeof(e));
+    nb = (size > EST_BLOCK) ? EST_BLOCKS : 1;
+    dp = (size > EST_FULL) ? EST_DEPTH : 0;
+
+    if (size > EST_FULL) {
+        bl = EST_BLOCK;
+    }
+    else if (size > EST_BLOCK) {
+        bl = size / (EST_BLOCKS * EST_SHARE);
+        bl = (bl < EST_MIN) ? EST_MIN : bl;
+    }
+    else {
+        bl = size;
+    }
+
+    for (i = 0; i < 5; ++i) {
+        n[i] = 0;
+        s[i] = 0;
+        q[i] = 0;
+        g[i] = 1.0;
+
+        if ((want >> i) & 1) {
+            enc_open(&e[i], i);
+        }
+    }
+
+    for (i = 0; i < 5; i = j) {
+        for (j = i + 1U; (j < 5) && ((want >> i) & 1) &&
+                         ((want >> j) & 1) && (e[j].x == e[i].x); ++j);
+
+        if (!((want >> i) & 1)) {
+            continue;
+        }
+
+        for (b = 0; b < nb; ++b) {
+            bs = (nb == 1) ? src : &src[(size - bl) / (nb - 1U) * b];
+            est_parse(&e[i], &n[i], j - i, fnd, src, bs, &bs[bl], srcz, dp,
+                      r);
+
+            for (k = i; k < j; ++k) {
+                s[k] += r[k - i];
+                q[k] += r[k - i] * r[k - i];
+            }
+        }
+
+        memset(&deep, 0, sizeof(deep));
+        enc_open(&deep, i);
+        dn = 0;
+        d[0] = 0;
+        d[1] = 0;
+
+        for (b = 0; (dp != 0) && (b < EST_BLOCKS); ++b) {
+            bs = &src[(size - EST_SLICE) / (EST_BLOCKS - 1U) * b];
+            est_parse(&deep, &dn, 1, fnd, src, bs, &bs[EST_SLICE], srcz,
+                      EST_DEPTH, &r[0]);
+            d[0] += r[0];
+            est_parse(&deep, &dn, 1, fnd, src, bs, &bs[EST_SLICE], srcz, 0,
+                      &r[0]);
+            d[1] += r[0];
+        }
+
+        enc_free(&deep);
+
+        for (k = i; (k < j) && (d[1] < d[0]); ++k) {
+            g[k] = d[1] / d[0];
+        }
+    }
+
+    for (i = 0; i < 5; ++i) {
+        if (!((want >> i) & 1)) {
+            continue;
+        }
+
+        if (nb == 1) {
+            k = e[i].T;
+
+            for (j = 0; k != 0; ++j, k >>= 1);
+
+            m = enc_size(i, (n[i] + j - 1U) / j, e[i].dicts->ct,
+                         e[i].bytes->ct) - enc_size(i, 0, 0, 0);
+            est[i][0] = enc_size(i, 0, 0, (u32)(m * g[i] + 0.5));
+            hw = 0;
+        }
+        else {
+            m = s[i] / nb;
+            r[0] = (q[i] / nb) - (m * m);
+            hw = 2.0 * root(r[0] / (nb - 1U)) * size *
+                 root(1.0 - ((double)(nb * bl) / size)) * g[i];
+            est[i][0] = enc_size(i, 0, 0, (u32)(m * g[i] * size + 0.5));
+        }
+
+        m = est[i][0] - hw - ((nb == 1) ? 0 : (size / bl) * EST_CUT);
+        m = (m > 0) ? m : 0;
+        est[i][1] = (u32)(m * (100 - EST_GAIN) / 100.0);
+        est[i][2] = (u32)((est[i][0] - enc_size(i, 0, 0, 0)) / g[i] +
+                          enc_size(i, 0, 0, 0) + hw + 0.5);
+        enc_free(&e[i]);
+    }
+
+    free(fnd);
+    return 0;
+}
+
+
+
+static void time_elapsed(void)
+{
+    struct tm time;
+    unsigned msec, sec;
+    char fmt[12];
+
+    msec = clock();
+    sec = msec / CLOCKS_PER_SEC;
+    memset(fmt, 0, 12);
+    memset(&time, 0, sizeof(time));
+    time.tm_yday = sec / 86400;
+    time.tm_hour = sec / 3600;
+    time.tm_min = (sec / 60) % 60;
+    time.tm_sec = sec % 60;
+    msec %= 1000;
+    strftime(fmt, 12, "%Hh:%Mm:%Ss", &time);
+    printf("Time Elapsed: %u day(s), %s;%.3ums\n",
+           time.tm_yday, fmt, msec);
+    return;
+}
+
+static float ratio(int b, float f1, float f2)
+{
+    float f[2] = { f1, f2 };
+    int bb = f1 < f2;
+
+    bb = !((bb == b) || (bb == !b));
+    return (((bb == 1) ? (f[0] / f[1]) : (f[1] / f[0])) * 100.0f);
+}
+
+static u8 fmtof(const int c)
+{
+    switch (toupper(c)) {
+        case 'G':   /* Mario 2 */
+            return 1;
+        case 'Z':   /* Zelda */
+            return 2;
+        case 'I':   /* Zelda 2 */
+            return 3;
+        case 'R':   /* Revolution */
+            return 4;
+        default:    /* Mario */
+            return 0;
+    }
+}
+
+static const char *fmtext[5] =
+{
+    ".mio0",
+    ".smsr00",
+    ".yay0",
+    ".yaz0",
+    ".rvl0"
+};
+
+/*  Longest name of an input, and room enough for any output named after
+    one: the longest extension added is "_decoded_.bin". */
+#define NAME_IN  240
+#define NAME_OUT (NAME_IN + 16)
+
+/*  Names the output of "in" as encoded to "type", or decoded, into the
+    "size" bytes of "o".  Returns zero unless the name does not fit. */
+static int name_output(char *o, const size_t size, const char *in,
+                       const int mode, const int type)
+{
+    const char *ext = "";
+    size_t n = strlen(in);
+
+    if (n >= size) {
+        return -1;
+    }
+
+    memcpy(o, in, n + 1U);
+
+    if (mode == 'D') {
+        char *a = o;
+        char *z = &a[n];
+
+        a = &a[2];
+
+        do {
+            if (*z == '.') {
+                *z = '\0';
+                break;
+            }
+            else if ((*z == '\\') || (*z == '/')) {
+                ext = ".bin";
+                break;
+            }
+            else if (z <= a) {
+                ext = "_decoded_.bin";
+                break;
+            }
+            else {
+                z = &z[-1];
+            }
+        } while (1);
+    }
+    else {
+        switch (toupper(type)) {
+            case 'I':
+                ext = ".szs";
+                break;
+            default:
+                ext = ".szp";
+                break;
+        }
+    }
+
+    n = strlen(o);
+    return (snprintf(&o[n], size - n, "%s", ext) < (int)(size - n)) ? 0 : -1;
+}
+
+/*  Reads the whole of "name" into a new buffer. */
+static u8 *load(const char *name, u32 *size)
+{
+    FILE *ifile;
+    u8 *buf = NULL;
+    long n;
+    unsigned long long t0 = trace_now();
+
+    if ((ifile = fopen(name, "rb")) == NULL) {
+        display_error(BAD_ARGS, (void *)name);
+        return NULL;
+    }
+
+    fseek(ifile, 0L, SEEK_END);
+    n = ftell(ifile);
+    fseek(ifile, 0L, SEEK_SET);
+
+    if ((n <= 0) || (n >= 0x3FFFFFFF)) {
+        display_error(FILE_SIZE_ERROR, (void *)&n);
+    }
+    else if ((buf = (u8 *)malloc(n)) == NULL) {
+        display_error(RAM_UNAVAILABLE, NULL);
+    }
+    else if (fread(buf, sizeof(u8), n, ifile) != (size_t)n) {
+        display_error(FILE_READ_ERROR, NULL);
+        free(buf);
+        buf = NULL;
+    }
+
+    fclose(ifile);
+    span("read", t0);
+    *size = (u32)n;
+    return buf;
+}
+
+/*  Writes the blocks of encode_formats() for "name": either each of them
+    with the extension of its format, or only the smallest one, named as a
+    single format encode would have named it. */
+static void emit_formats(u8 *src, u8 *srcz, const u32 want,
+                         const char *name, const int smallest)
+{
+    FILE *ofile;
+    u8 *dst[5];
+    u32 size[5], i;
+    char o[NAME_OUT];
+    u8 best = encode_formats(src, srcz, want, dst, size);
+    unsigned long long t0;
+
+    for (i = 0; i < 5; ++i) {
+        if ((dst[i] == NULL) || (smallest && (i != best))) {
+            continue;
+        }
+
+        if ((snprintf(o, sizeof(o), "%s%s", name, (smallest == 0) ? fmtext[i]
+                      : ((i == 3) ? ".szs" : ".szp")) >= (int)sizeof(o)) ||
+            ((ofile = fopen(o, "wb")) == NULL)) {
+            display_error(BAD_ARGS, (void *)o);
+            continue;
+        }
+
+        t0 = trace_now();
+        fwrite(dst[i], sizeof(u8), size[i], ofile);
+        fclose(ofile);
+        span("write", t0);
+        printf(">>> %s IN: %u , OUT: %u , RATIO: %3.2f%%\n",
+               &fmtext[i][1], (unsigned)(srcz - src), (unsigned)size[i],
+               ratio(1, srcz - src, size[i]));
+    }
+
+    for (i = 0; i < 5; ++i) {
+        free(dst[i]);
+        dst[i] = NULL;
+    }
+
+    return;
+}
+
+/*  Prints the sizes estimate() predicts for the formats of "want". */
+static void predict(u8 *src, u8 *srcz, const u32 want)
+{
+    u32 est[5][3], i;
+    int err;
+
+    if ((err = estimate(src, srcz, want, est)) != 0) {
+        display_error(err, NULL);
+        return;
+    }
+
+    for (i = 0; i < 5; ++i) {
+        if ((want >> i) & 1) {
+            printf(">>> %s IN: %u , EST: %u [%u - %u] , RATIO: %3.2f%%\n",
+                   &fmtext[i][1], (unsigned)(srcz - src), (unsigned)est[i][0],
+                   (unsigned)est[i][1], (unsigned)est[i][2],
+                   ratio(1, srcz - src, est[i][0]));
+        }
+    }
+
+    return;
+}
+
+/*---------------------------------------------------------------------------
+
+                               Server Section
+
+---------------------------------------------------------------------------*/
+
+
+
+/*  A server keeps a pool of workers warm on a local socket, so that scripts
+    processing many small files are spared the start-up of a process for
+    each one.  A connection carries any number of requests, each answered
+    in turn by the worker which accepted it.  Requests either name a file,
+    encoded or decoded next to itself exactly as the command line would,
+    or carry the data itself, answered with the encoded or decoded data. */
+#define REQ_PATH 'P'
+#define REQ_DATA 'B'
+
+typedef struct req_s {
+    u8 mode, /* 'E'ncode | 'D'ecode */
+       kind, /* REQ_PATH | REQ_DATA */
+       type, /* 'M' | 'G' | 'Z' | 'I' | 'R' */
+       pad;
+    u32 n;   /* size of the path or data that follows */
+} req_t;
+
+typedef struct rep_s {
+    i32 err; /* zero, or an error code for display_error() */
+    u32 isize,
+        osize,
+        n;   /* size of the output path or data that follows */
+} rep_t;
+
+typedef struct wrk_s {
+    pthread_t id;
+    int fd,    /* listening socket */
+        conn;  /* connection being served, or -1 */
+    enc_t e;   /* vectors reused by every encode */
+    u8 *src;   /* input buffer reused by every request */
+    size_t cap;
+} wrk_t;
+
+static int xread(const int fd, void *p, size_t n)
+{
+    char *s = (char *)p;
+    ssize_t r;
+
+    while (n != 0) {
+        if ((r = read(fd, s, n)) <= 0) {
+            if ((r < 0) && (errno == EINTR)) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        s = &s[r];
+        n -= (size_t)r;
+    }
+
+    return 0;
+}
+
+static int xwrite(const int fd, const void *p, size_t n)
+{
+    const char *s = (const char *)p;
+    ssize_t r;
+
+    while (n != 0) {
+        if ((r = send(fd, s, n, MSG_NOSIGNAL)) <= 0) {
+            if ((r < 0) && (errno == EINTR)) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        s = &s[r];
+        n -= (size_t)r;
+    }
+
+    return 0;
+}
+
+/*  Grows the input buffer of "w" to "n" bytes and the suffix byte. */
+static u8 *wgrow(wrk_t *w, const size_t n)
+{
+    u8 *p;
+
+    if (w->cap < (n + 1)) {
+        if ((p = (u8 *)realloc(w->src, n + 1)) == NULL) {
+            return NULL;
+        }
+
+        w->src = p;
+        w->cap = n + 1;
+    }
+
+    return w->src;
+}
+
+/*  Reads the "n" bytes of data a request carries into the input buffer of
+    "w", growing it only as they arrive, by at most double what came so
+    far, so that the size a request claims commits no memory by itself.
+    Returns zero, RAM_UNAVAILABLE, or -1 if the connection failed. */
+#define REQ_CHUNK 0x10000U
+
+static int wread(wrk_t *w, const int fd, const size_t n)
+{
+    size_t got, k;
+
+    for (got = 0; got < n; got += k) {
+        k = (got < REQ_CHUNK) ? REQ_CHUNK : got;
+        k = ((n - got) < k) ? (n - got) : k;
+
+        if (wgrow(w, got + k) == NULL) {
+            return RAM_UNAVAILABLE;
+        }
+
+        if (xread(fd, &w->src[got], k) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int sock_open(const char *sock, struct sockaddr_un *sa)
+{
+    int fd;
+
+    if (strlen(sock) >= sizeof(sa->sun_path)) {
+        return -1;
+    }
+
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    strcpy(sa->sun_path, sock);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    return fd;
+}
+
+/*  Answers one request on "fd"; anything but zero ends the connection. */
+static int serve(wrk_t *w, const int fd)
+{
+    FILE *ifile, *ofile = NULL;
+    req_t rq;
+    rep_t rp;
+    u8 *src = NULL, *srcz;
+    char path[NAME_IN], o[NAME_OUT], *buf = NULL;
+    size_t len = 0;
+    long osize;
+    unsigned long long t0, t1;
+
+    if (xread(fd, &rq, sizeof(rq)) != 0) {
+        return -1;
+    }
+
+    t0 = trace_now();
+
+    memset(&rp, 0, sizeof(rp));
+
+    if (((rq.mode != 'E') && (rq.mode != 'D')) ||
+        ((rq.kind != REQ_PATH) && (rq.kind != REQ_DATA)) ||
+        (rq.type == '\0') || (strchr("MGZIR", rq.type) == NULL) ||
+        ((rq.kind == REQ_PATH) && (rq.n >= sizeof(path)))) {
+        rp.err = BAD_ARGS;
+        xwrite(fd, &rp, sizeof(rp));
+        return -1;
+    }
+
+    if (rq.kind == REQ_PATH) {
+        if (xread(fd, path, rq.n) != 0) {
+            return -1;
+        }
+
+        path[rq.n] = '\0';
+        t1 = trace_now();
+
+        if ((ifile = fopen(path, "rb")) == NULL) {
+            rp.err = BAD_ARGS;
+            goto reply;
+        }
+
+        fseek(ifile, 0L, SEEK_END);
+        rp.isize = (u32)ftell(ifile);
+        fseek(ifile, 0L, SEEK_SET);
+
+        if ((rp.isize == 0) || (rp.isize >= 0x3FFFFFFF)) {
+            rp.err = FILE_SIZE_ERROR;
+        }
+        else if ((src = wgrow(w, rp.isize)) == NULL) {
+            rp.err = RAM_UNAVAILABLE;
+        }
+        else if (fread(src, sizeof(u8), rp.isize, ifile) != rp.isize) {
+            rp.err = FILE_READ_ERROR;
+        }
+
+        fclose(ifile);
+        span("read", t1);
+
+        if (rp.err != 0) {
+            goto reply;
+        }
+
+        if (name_output(o, sizeof(o), path, rq.mode, rq.type) != 0) {
+            rp.err = BAD_ARGS;
+            goto reply;
+        }
+
+        ofile = fopen(o, "wb");
+    }
+    else {
+        rp.isize = rq.n;
+
+        if ((rp.isize == 0) || (rp.isize >= 0x3FFFFFFF)) {
+            rp.err = FILE_SIZE_ERROR;
+            xwrite(fd, &rp, sizeof(rp));
+            return -1;
+        }
+
+        t1 = trace_now();
+
+        if ((rp.err = wread(w, fd, rp.isize)) != 0) {
+            if (rp.err > 0) {
+                xwrite(fd, &rp, sizeof(rp));
+            }
+
+            return -1;
+        }
+
+        src = w->src;
+        span("read", t1);
+
+        ofile = open_memstream(&buf, &len);
+    }
+
+    if (ofile == NULL) {
+        rp.err = (rq.kind == REQ_PATH) ? BAD_ARGS : RAM_UNAVAILABLE;
+        goto reply;
+    }
+
+    srcz = &src[rp.isize];
+    *srcz = fmtof(rq.type);
+
+    if (rq.mode == 'E') {
+        encode_with(&w->e, src, srcz, ofile);
+    }
+    else {
+        rp.err = decode_with(src, srcz, ofile, 1);
+    }
+
+    osize = ftell(ofile);
+    fclose(ofile);
+    rp.osize = (osize > 0) ? (u32)osize : 0;
 
-        while (hdr < hdrz) {
-            tmp = *g++;
-            strinv(&tmp, 4);
-            *hdr++ = tmp;
+    if ((rp.err != 0) || (rp.osize == 0)) {
+        rp.err = (rp.err != 0) ? rp.err : RAM_UNAVAILABLE;
+
+        if (rq.kind == REQ_PATH) {
+            remove(o);
         }
-    } while (0);
+    }
 
-    dstp = &dstp[0x10];
+reply:
+
+    span((rq.kind == REQ_PATH) ? path : "data", t0);
+
+    if ((rp.err == 0) && (rq.kind == REQ_PATH)) {
+        rp.n = strlen(o);
+    }
+    else if (rp.err == 0) {
+        rp.n = rp.osize;
+    }
+
+    if ((xwrite(fd, &rp, sizeof(rp)) != 0) ||
+        (xwrite(fd, (rq.kind == REQ_PATH) ? o : buf, rp.n) != 0)) {
+        rp.err = -1;
+    }
+
+    free(buf);
+    buf = NULL;
+    return (rp.err < 0) ? -1 : 0;
+}
+
+/*  Set once a server is stopping, with every worker's connection shut
+    for reading, so that each one ends after the request it is on. */
+static pthread_mutex_t wrkmu = PTHREAD_MUTEX_INITIALIZER;
+static int stopping = 0;
+
+static void *worker(void *arg)
+{
+    wrk_t *w = (wrk_t *)arg;
+    int fd;
+
+    while (1) {
+        if ((fd = accept(w->fd, NULL, NULL)) < 0) {
+            if ((errno == EINTR) || (errno == ECONNABORTED)) {
+                continue;
+            }
 
-    switch (*srcz) {
-        case 1:     /* Mario 2 */
-            assemble = assemble_groups;
-            break;
-        case 3:     /* Zelda 2 */
-            assemble = assemble_stream;
             break;
-        default:
-            assemble = assemble_tables;
+        }
+
+        pthread_mutex_lock(&wrkmu);
+        w->conn = (stopping == 0) ? fd : -1;
+        pthread_mutex_unlock(&wrkmu);
+
+        if (w->conn < 0) {
+            close(fd);
             break;
-    }
+        }
 
-    assemble(dstp, dstz, flags, dicts, bytes);
-    fwrite(dst, sizeof(u8), dstz - dst, ofile);
-    fflush(ofile);
-    free(dst);
-    dst = NULL;
+        while (serve(w, fd) == 0);
 
-err:
+        pthread_mutex_lock(&wrkmu);
+        w->conn = -1;
+        pthread_mutex_unlock(&wrkmu);
+        close(fd);
+    }
 
-    bytes = vfree(bytes);
-    dicts = vfree(dicts);
-    flags = vfree(flags);
-    return;
+    enc_free(&w->e);
+    free(w->src);
+    w->src = NULL;
+    return NULL;
 }
 
-static void decode(u8 *src, u8 *srcz, FILE *ofile)
+/*  Serves requests on "sock" with "n" workers until it fails. */
+static int server(const char *sock, const unsigned n)
 {
-    u8 *srcp, *dst, *dstp, *dstz, *w, *h, *b;
-    i32 f;
-    u32 n, tmp, T, t, tt;
+    struct sockaddr_un sa;
+    sigset_t sigs;
+    wrk_t *w;
+    unsigned i, j;
+    int fd, sig, ret = EXIT_FAILURE;
+
+    if ((fd = sock_open(sock, &sa)) < 0) {
+        display_error(BAD_ARGS, (void *)sock);
+        return EXIT_FAILURE;
+    }
 
-    tmp = *(u32 *)&src[(*srcz == 1) ? 0x08 : 0x04];
-    strinv(&tmp, 4);
+    unlink(sock);
 
-    if ((dst = (u8 *)calloc(tmp, sizeof(u8))) == NULL) {
+    if ((bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+        (listen(fd, SOMAXCONN) != 0)) {
+        display_error(BAD_ARGS, (void *)sock);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    if ((w = (wrk_t *)calloc(n, sizeof(wrk_t))) == NULL) {
         display_error(RAM_UNAVAILABLE, NULL);
-        goto end;
+        close(fd);
+        return EXIT_FAILURE;
     }
 
-    dstp = dst;
-    dstz = &dstp[tmp];
-    tmp = *(u32 *)&src[0x08];
-    strinv(&tmp, 4);
-    h = &src[tmp];
-    tmp = *(u32 *)&src[0x0C];
-    strinv(&tmp, 4);
-    b = &src[tmp + ((*srcz == 1) ? 0x10 : 0)];
-    n = 0;
-    w = &src[0x10];
-    srcp = &src[0x10];
-
-    switch (*srcz) {
-        case 1:
-            T = 2;
-            break;
-        case 3:
-            T = 1;
-            break;
-        default:
-            T = 4;
+    printf(">>> SERVING: %s , WORKERS: %u\n", sock, n);
+    fflush(stdout);
+
+/*  A traced server is only ever stopped by a signal, which is waited for
+    here, rather than handled.  The workers are then stopped and joined, so
+    that the trace is written out at exit with none of them recording. */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+
+    if (tracefile != NULL) {
+        pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    }
+
+    for (i = 0; i < n; ++i) {
+        w[i].fd = fd;
+        w[i].conn = -1;
+
+        if (pthread_create(&w[i].id, NULL, worker, &w[i]) != 0) {
             break;
+        }
     }
 
-    t = (8 << (T >> 1));
-    tt = (32 - (T << 3));
+    if ((tracefile != NULL) && (i != 0) && (sigwait(&sigs, &sig) == 0)) {
+        pthread_mutex_lock(&wrkmu);
+        stopping = 1;
 
-    do {
-        if (n != 0) {
-            if ((f < 0) == 0) {
-                u16 d;
-                u32 l;
-                u8 *p;
-
-                switch (*srcz) {
-                    case 1:
-                    case 3:
-                        memcpy(&d, w, 2);
-                        w = &w[2];
-                        break;
-                    default:
-                        memcpy(&d, h, 2);
-                        h = &h[2];
-                        break;
+        for (j = 0; j < i; ++j) {
+            if (w[j].conn >= 0) {
+                shutdown(w[j].conn, SHUT_RD);
+            }
+        }
+
+        pthread_mutex_unlock(&wrkmu);
+        shutdown(fd, SHUT_RDWR);
+        ret = EXIT_SUCCESS;
+    }
+
+    while (i--) {
+        pthread_join(w[i].id, NULL);
+    }
+
+    free(w);
+    close(fd);
+    unlink(sock);
+    return ret;
+}
+
+/*  Has a server at "sock" encode or decode the file "in", in place of
+    the command line doing so itself. */
+static int client(const char *sock, const int mode, const int type,
+                  const char *in)
+{
+    struct sockaddr_un sa;
+    req_t rq;
+    rep_t rp;
+    char path[PATH_MAX], o[NAME_OUT];
+    int fd;
+
+    if (realpath(in, path) == NULL) {
+        display_error(BAD_ARGS, (void *)in);
+        return EXIT_FAILURE;
+    }
+
+    memset(&rq, 0, sizeof(rq));
+    rq.mode = (u8)mode;
+    rq.kind = REQ_PATH;
+    rq.type = (u8)toupper(type);
+    rq.n = strlen(path);
+
+    if ((fd = sock_open(sock, &sa)) < 0) {
+        display_error(BAD_ARGS, (void *)sock);
+        return EXIT_FAILURE;
+    }
+
+    if ((connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+        (xwrite(fd, &rq, sizeof(rq)) != 0) ||
+        (xwrite(fd, path, rq.n) != 0) ||
+        (xread(fd, &rp, sizeof(rp)) != 0) ||
+        (rp.n >= sizeof(o)) ||
+        (xread(fd, o, rp.n) != 0)) {
+        display_error(BAD_ARGS, (void *)sock);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    close(fd);
+
+    if (rp.err != 0) {
+        display_error(rp.err, (rp.err == BAD_ARGS) ? (void *)in
+                                                   : (void *)&rp.isize);
+        return EXIT_FAILURE;
+    }
+
+    printf(">>> IN: %u , OUT: %u , RATIO: %3.2f%%\n",
+           (unsigned)rp.isize, (unsigned)rp.osize,
+           ratio(mode == 'E', rp.isize, rp.osize));
+    time_elapsed();
+    return EXIT_SUCCESS;
+}
+
+
+
+#ifdef LZSZ_SELFTEST
+/*---------------------------------------------------------------------------
+
+                              Self-Test Section
+
+---------------------------------------------------------------------------*/
+
+
+
+/*  Built with LZSZ_SELFTEST, lzsz checks its match finders against search()
+    at every position of generated inputs and of the files it is given, for
+    the maximum lengths of every format, and exits with the number of inputs
+    they differed on.  The inputs are random bytes, a few letters at random,
+    and runs of a byte or of a pattern of 2 or 4 bytes mixed with copies and
+    random bytes, the runs being either short or longer than the window, so
+    that the run shortcut answers past it.  Files are cut to TEST_FILE. */
+#define TEST_SIZE  0x8000
+#define TEST_FILE  0x20000
+#define TEST_SEEDS 4
+#define TEST_KINDS 4
+
+static u32 test_rnd(u32 *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+static void test_input(u8 *src, const u32 n, const u32 kind, u32 seed)
+{
+    u32 i = 0, k, j, p, c, a = 2U + (seed % 3U);
+
+    while (i < n) {
+        switch (c = (kind >= 2) ? (test_rnd(&seed) % 5U) : kind) {
+            case 0:     /* random bytes */
+                k = 1U + (test_rnd(&seed) % 8U);
+
+                for (j = 0; (j < k) && (i < n); ++j) {
+                    src[i++] = (u8)(test_rnd(&seed) >> 24);
+                }
+                break;
+            case 1:     /* a few letters */
+                src[i++] = (u8)('a' + (test_rnd(&seed) % a));
+                break;
+            case 2:     /* a run of a byte */
+            case 3:     /* of a pattern of 2 or 4 bytes */
+                p = (c == 2) ? 1U : ((test_rnd(&seed) & 1U) ? 4U : 2U);
+                k = (kind == 3) ? (0x1008U + (test_rnd(&seed) % 0x2000U))
+                                : (1U + (test_rnd(&seed) % 0x1FFU));
+
+                for (j = 0; (j < p) && (i < n); ++j) {
+                    src[i++] = (u8)(test_rnd(&seed) >> 24);
                 }
 
-                strinv(&d, 2);
-                l = d >> 12;
-                d &= 0xFFF;
-                p = &dstp[~d];
-                srcp = &srcp[2];
-
-                switch (*srcz) {
-                    case 2:     /* Zelda */
-                    case 3:     /* Zelda 2 */
-                        if (l == 0) {
-                            l = (u32)((*srcz == 3) ? *w++ : *b++);
-                            l += 18U;
-                            srcp = &srcp[1];
-                        }
-                        else {
-                            l += 2U;
-                        }
-                        break;
-                    case 4:     /* Revolution */
-                        if (l == 0) {
-                            l = (u32)*b++;
-                            l += 17U;
-                            srcp = &srcp[1];
-                        }
-                        else if (l == 1) {
-                            memcpy(&l, h, 2);
-                            h = &h[2];
-                            strinv(&l, 2);
-                            l += 273U;
-                            srcp = &srcp[2];
-                        }
-                        else {
-                            ++l;
-                        }
-                        break;
-                    default:    /* Mario */
-                        l += 3U;
-                        break;
+                for (j = 0; (j < k) && (i < n); ++j, ++i) {
+                    src[i] = src[i - p];
                 }
+                break;
+            default:    /* a copy from the window */
+                k = 3U + (test_rnd(&seed) % 0x100U);
+                p = 1U + (test_rnd(&seed) % 0x1100U);
 
-                do {
-                    *dstp++ = *p++;
-                } while (--l);
-            }
-            else {
-                *dstp++ = *b++;
-                srcp = &srcp[1];
-            }
+                for (j = 0; (j < k) && (i < n) && (p <= i); ++j, ++i) {
+                    src[i] = src[i - p];
+                }
 
-            f <<= 1;
-            --n;
-        }
-        else {
-            memcpy(&f, w, T);
-            w = &w[T];
-            strinv(&f, T);
-            f <<= tt;
-            n = t;
-            srcp = &srcp[T];
+                if (p > i) {
+                    src[i++] = (u8)(test_rnd(&seed) >> 24);
+                }
+                break;
         }
-    } while ((dstp < dstz) && (srcp < srcz));
-
-    fwrite(dst, sizeof(u8), dstz - dst, ofile);
-    fflush(ofile);
-    free(dst);
-    dst = NULL;
-
-end:
+    }
 
     return;
 }
 
-static void time_elapsed(void)
+/*  Compares the finders at every position of "src" for every maximum
+    length, reporting each as "name"; returns how many differed. */
+static int test_finders(fnd_t *f, const char *name, u8 *src, u8 *srcz)
 {
-    struct tm time;
-    unsigned msec, sec;
-    char fmt[12];
+    run_t run;
+    u8 *srcp;
+    u32 fmt, o[3], l[3];
+    int fails = 0;
+
+    for (fmt = 0; fmt < 5; fmt += 2) {
+        fnd_open(f, src);
+        run_open(&run, src);
+
+        for (srcp = src; srcp < srcz; ++srcp) {
+            search(src, srcp, srcz, &o[0], &l[0], fmtq[0][fmt]);
+            search_hash(f, src, srcp, srcz, &o[1], &l[1], fmtq[0][fmt]);
+
+            if (!search_runs(&run, src, srcp, srcz, &o[2], &l[2],
+                             fmtq[0][fmt])) {
+                o[2] = o[0];
+                l[2] = l[0];
+            }
 
-    msec = clock();
-    sec = msec / CLOCKS_PER_SEC;
-    memset(fmt, 0, 12);
-    memset(&time, 0, sizeof(time));
-    time.tm_yday = sec / 86400;
-    time.tm_hour = sec / 3600;
-    time.tm_min = (sec / 60) % 60;
-    time.tm_sec = sec % 60;
-    msec %= 1000;
-    strftime(fmt, 12, "%Hh:%Mm:%Ss", &time);
-    printf("Time Elapsed: %u day(s), %s;%.3ums\n",
-           time.tm_yday, fmt, msec);
-    return;
+            if ((o[1] != o[0]) || (l[1] != l[0]) ||
+                (o[2] != o[0]) || (l[2] != l[0])) {
+                break;
+            }
+        }
+
+        printf(">>> %s, max 0x%05X: ", name, (unsigned)fmtq[0][fmt]);
+
+        if (srcp == srcz) {
+            printf("OK\n");
+            continue;
+        }
+
+        printf("at 0x%X, search() %u/0x%X, search_hash() %u/0x%X,"
+               " search_runs() %u/0x%X\n", (unsigned)(srcp - src),
+               (unsigned)l[0], (unsigned)o[0], (unsigned)l[1],
+               (unsigned)o[1], (unsigned)l[2], (unsigned)o[2]);
+        fails++;
+    }
+
+    return fails;
 }
 
-static float ratio(int b, float f1, float f2)
+static int selftest(const int argc, char *argv[])
 {
-    float f[2] = { f1, f2 };
-    int bb = f1 < f2;
+    static const char *kinds[TEST_KINDS] = {
+        "random", "letters", "runs", "long runs"
+    };
+    u8 *src = (u8 *)malloc(TEST_SIZE + 1), *buf;
+    fnd_t *f = (fnd_t *)malloc(sizeof(fnd_t));
+    char name[0x40];
+    u32 kind, seed, n;
+    int fails = 0, i;
+
+    if ((src == NULL) || (f == NULL)) {
+        display_error(RAM_UNAVAILABLE, NULL);
+        return EXIT_FAILURE;
+    }
 
-    bb = !((bb == b) || (bb == !b));
-    return (((bb == 1) ? (f[0] / f[1]) : (f[1] / f[0])) * 100.0f);
+    for (kind = 0; kind < TEST_KINDS; ++kind) {
+        for (seed = 1; seed <= TEST_SEEDS; ++seed) {
+            test_input(src, TEST_SIZE, kind, seed * 0x9E3779B1U);
+            snprintf(name, sizeof(name), "%-9s seed %u", kinds[kind],
+                     (unsigned)seed);
+            fails += (test_finders(f, name, src, &src[TEST_SIZE]) != 0);
+        }
+    }
+
+    for (i = 1; i < argc; ++i) {
+        if ((buf = load(argv[i], &n)) == NULL) {
+            fails++;
+            continue;
+        }
+
+        fails += (test_finders(f, argv[i], buf,
+                               &buf[(n < TEST_FILE) ? n : TEST_FILE]) != 0);
+        free(buf);
+    }
+
+    free(f);
+    free(src);
+    return fails;
 }
+#endif
+
 
 int main(int argc, char *argv[])
 {
     void (*op)(u8 *, u8 *, FILE *);
-    FILE *ifile = NULL, *ofile = NULL;
+    FILE *ifile = NULL, *ofile = NULL, *mark;
     u8 *src = NULL, *srcz;
-    char *s, o[240];
+    char *s, o[NAME_OUT], *sock = NULL, *prev[2] = { NULL, NULL },
+         *local = NULL, /* an option a server would not take up */
+         *serial = NULL; /* one only a single format's encode takes up */
     ssize_t isize, osize = 0;
+    u32 want = 0, n;
+    int mode, multi, i;
+    inc_t inc;
+    unsigned long long t0, t1;
+
+#ifdef LZSZ_SELFTEST
+    return selftest(argc, argv);
+#endif
 
-    if (argc != 4) {
+    if (argc < 4) {
         display_error(0, NULL);
         exit(EXIT_FAILURE);
     }
 
-    if ((s = argv[1], s[1] || strpbrk(s, "DEde") == NULL) ||
-        (s = argv[2], s[1] || strpbrk(s, "MGZIRmgzir") == NULL) ||
+    if ((toupper(*argv[1]) == 'L') && (argv[1][1] == '\0')) {
+        unsigned long n = strtoul(argv[2], &s, 10);
+
+        if (((argc != 4) && ((argc != 6) || strcmp(argv[4], "-j"))) ||
+            (*s != '\0') || (n == 0) || (n > 256)) {
+            display_error(BAD_ARGS, (void *)argv[2]);
+            exit(EXIT_FAILURE);
+        }
+
+        if (argc == 6) {
+            trace_open(argv[5]);
+        }
+
+        exit(server(argv[3], (unsigned)n));
+    }
+
+    for (i = 4; i < argc; ++i) {
+        if ((strcmp(argv[i], "-c") == 0) && ((i + 1) < argc)) {
+            sock = argv[++i];
+        }
+        else if (strcmp(argv[i], "-f") == 0) {
+            fast = 1;
+            local = argv[i];
+            serial = local;
+        }
+        else if (strcmp(argv[i], "-v") == 0) {
+            verify = 1;
+            local = argv[i];
+            serial = local;
+        }
+        else if (strcmp(argv[i], "-u") == 0) {
+            untrusted = 1;
+            local = argv[i];
+        }
+        else if (strcmp(argv[i], "-x") == 0) {
+            skip = 1;
+            local = argv[i];
+            serial = local;
+        }
+        else if ((strcmp(argv[i], "-j") == 0) && ((i + 1) < argc)) {
+            trace_open(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-d") == 0) && ((i + 1) < argc) &&
+                 ((deadline = (unsigned)strtoul(argv[++i], &s, 10)) != 0) &&
+                 (*s == '\0')) {
+            local = "-d";
+            serial = local;
+        }
+        else if ((strcmp(argv[i], "-p") == 0) && ((i + 2) < argc)) {
+            prev[0] = argv[++i];
+            prev[1] = argv[++i];
+        }
+        else if ((strcmp(argv[i], "-r") == 0) && ((i + 1) < argc) &&
+                 (tolerance = (unsigned)strtoul(argv[++i], &s, 10),
+                  *s == '\0') && (tolerance <= 1000)) {
+            local = "-r";
+            serial = local;
+        }
+        else if ((strcmp(argv[i], "-t") == 0) && ((i + 1) < argc) &&
+                 ((prepass = (unsigned)strtoul(argv[++i], &s, 10)) != 0) &&
+                 (*s == '\0') && (prepass <= 256)) {
+            local = "-t";
+        }
+        else {
+            display_error(BAD_ARGS, (void *)argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if ((s = argv[1], s[1] || strpbrk(s, "DEPSdeps") == NULL) ||
+        (s = argv[2], (*s == '\0') ||
+         (strspn(s, "MGZIRmgzir") != strlen(s)) ||
+         (s[1] && (toupper(*argv[1]) == 'D'))) ||
         (s = argv[3], (ifile = fopen(s, "rb")) == NULL)) {
         display_error(BAD_ARGS, (void *)s);
         exit(EXIT_FAILURE);
     }
 
-    strcpy(o, argv[3]);
+    mode = toupper(*argv[1]);
+    t0 = trace_now();
 
-    if (toupper(*argv[1]) == 'D') {
-        char *a = o;
-        char *z = &a[strlen(o)];
+    for (s = argv[2]; *s != '\0'; ++s) {
+        want |= 1U << fmtof(*s);
+    }
 
-        a = &a[2];
+/*  Several formats at once, or the smallest of them, share one encode;
+    predictions do not write any. */
+    multi = (mode == 'S') || (mode == 'P') || ((want & (want - 1U)) != 0);
 
-        do {
-            if (*z == '.') {
-                *z = '\0';
-                break;
-            }
-            else if ((*z == '\\') || (*z == '/')) {
-                strcat(o, ".bin");
-                break;
-            }
-            else if (z <= a) {
-                strcat(o, "_decoded_.bin");
-                break;
-            }
-            else {
-                z = &z[-1];
-            }
-        } while (1);
+    if (multi && (serial != NULL)) {
+        display_error(BAD_ARGS, (void *)serial);
+        exit(EXIT_FAILURE);
     }
-    else {
-        switch (toupper(*argv[2])) {
-            case 'I':
-                strcat(o, ".szs");
-                break;
-            default:
-                strcat(o, ".szp");
-                break;
+
+    if (sock != NULL) {
+        fclose(ifile);
+
+        if (multi || (prev[0] != NULL)) {
+            display_error(BAD_ARGS, (void *)argv[2]);
+            exit(EXIT_FAILURE);
+        }
+
+/*  The server's workers share its settings, and a request carries none. */
+        if (local != NULL) {
+            display_error(BAD_ARGS, (void *)local);
+            exit(EXIT_FAILURE);
+        }
+
+        exit(client(sock, mode, *argv[2], argv[3]));
+    }
+
+/*  The previous files are read before the output may replace one. */
+    if (prev[0] != NULL) {
+        if (multi || (mode != 'E')) {
+            display_error(BAD_ARGS, (void *)"-p");
+            exit(EXIT_FAILURE);
+        }
+
+        memset(&inc, 0, sizeof(inc));
+
+        if (((inc.src = load(prev[0], &n)) == NULL) ||
+            ((inc.enc = load(prev[1], &inc.size)) == NULL)) {
+            exit(EXIT_FAILURE);
+        }
+
+        inc.srcz = &inc.src[n];
+
+        if ((s = rough_name(prev[1])) != NULL) {
+            if ((ofile = fopen(s, "rb")) != NULL) {
+                inc.rough = 1;
+                fclose(ofile);
+                ofile = NULL;
+            }
+
+            free(s);
         }
+
+        previous = &inc;
     }
 
-    if ((ofile = fopen(o, "wb")) == NULL) {
-        display_error(BAD_ARGS, (void *)o);
+    if (!multi &&
+        ((name_output(o, sizeof(o), argv[3], mode, *argv[2]) != 0) ||
+         ((ofile = fopen(o, "wb")) == NULL))) {
+        display_error(BAD_ARGS, (void *)argv[3]);
         exit(EXIT_FAILURE);
     }
 
@@ -909,38 +3929,50 @@ int main(int argc, char *argv[])
         goto nil;
     }
 
+    t1 = trace_now();
+
     if (fread(src, sizeof(u8), isize, ifile) != (size_t)isize) {
         display_error(FILE_READ_ERROR, NULL);
         goto nil;
     }
 
-    op = (toupper(*argv[1]) == 'E') ? encode : decode;
+    span("read", t1);
+
+    op = (mode == 'E') ? encode : decode;
     srcz = &src[isize];
 /*  With the suffix byte, we can send simple config information. */
-    switch (toupper(*argv[2])) {
-        case 'G':   /* Mario 2 */
-            *srcz = 1;
-            break;
-        case 'Z':   /* Zelda */
-            *srcz = 2;
-            break;
-        case 'I':   /* Zelda 2 */
-            *srcz = 3;
-            break;
-        case 'R':   /* Revolution */
-            *srcz = 4;
-            break;
-        default:    /* Mario */
-            *srcz = 0;
-            break;
+    *srcz = fmtof(*argv[2]);
+
+    if (mode == 'P') {
+        predict(src, srcz, want);
+    }
+    else if (multi) {
+        emit_formats(src, srcz, want, argv[3], mode == 'S');
     }
+    else {
+        op(src, srcz, ofile);
+        osize = (ssize_t)ftell(ofile);
+    }
+
+    if ((mode == 'E') && !multi && (osize > 0) &&
+        ((s = rough_name(o)) != NULL)) {
+        if (!rough) {
+            remove(s);
+        }
+        else if ((mark = fopen(s, "w")) != NULL) {
+            fprintf(mark, "not parsed at full effort\n");
+            fclose(mark);
+        }
 
-    op(src, srcz, ofile);
-    osize = (ssize_t)ftell(ofile);
+        free(s);
+    }
 
 nil:
 
-    fclose(ofile);
+    if (ofile != NULL) {
+        fclose(ofile);
+    }
+
     fclose(ifile);
 
     if (src != NULL) {
@@ -948,16 +3980,32 @@ nil:
         src = NULL;
     }
 
-    if (osize <= 0) {
+    if (previous != NULL) {
+        free(inc.src);
+        free(inc.enc);
+
+        if (inc.tok != NULL) {
+            inc.tok = vfree(inc.tok);
+        }
+
+        previous = NULL;
+    }
+
+    if (!multi && (osize <= 0)) {
         remove(o);
     }
 
     if ((isize > 0) && (osize > 0)) {
         printf(">>> IN: %u , OUT: %u , RATIO: %3.2f%%\n",
                (unsigned)isize, (unsigned)osize,
-               ratio(toupper(*argv[1]) == 'E', isize, osize));
+               ratio(mode == 'E', isize, osize));
+    }
+
+    if (skip && (mode == 'E')) {
+        printf(">>> UNSEARCHED: %u\n", (unsigned)unsearched);
     }
 
+    span(argv[3], t0);
     time_elapsed();
     exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,108 @@
+#!/bin/sh
+#
+#   Times lzsz decoding text, noise and run-heavy inputs in every format,
+#   against an older lzsz decoding the very same files, and checks that
+#   both give the input back.  The older one is either a binary, or a git
+#   revision of the tree built as the README says; it defaults to the
+#   decoder before the literal runs and the per format decoders, with only
+#   the fix letting it read Yaz0 at all.  Each time is the best of "runs".
+#
+#   usage: tools/bench_decode.sh [lzsz] [old lzsz | revision] [MiB ...]
+#
+
+LZSZ=${1:-./lzsz}
+[ $# -gt 0 ] && shift
+OLD=${1:-0173759}
+[ $# -gt 0 ] && shift
+SIZES=${*:-4 16}
+RUNS=${RUNS:-5}
+ROOT=$(dirname "$0")/..
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+if [ ! -x "$OLD" ]; then
+    git -C "$ROOT" show "$OLD:src/lzsz.c" > "$DIR/old.c" || exit 1
+    "${CC:-cc}" -std=c99 -Os -s -pthread -o "$DIR/old" "$DIR/old.c" ||
+        exit 1
+    OLD=$DIR/old
+fi
+
+now() {
+    date +%s.%N
+}
+
+# the tree's own source over and over, random bytes, and runs of random
+# bytes and lengths up to 64 KiB
+make_input() {
+    n=$(($2 * 1048576))
+
+    case $1 in
+        text)
+            cat "$ROOT/src/lzsz.c" > "$DIR/text"
+
+            while [ "$(wc -c < "$DIR/text")" -lt $n ]; do
+                cat "$DIR/text" "$DIR/text" > "$DIR/twice"
+                mv "$DIR/twice" "$DIR/text"
+            done
+
+            head -c $n "$DIR/text"
+            ;;
+        noise)
+            head -c $n /dev/urandom
+            ;;
+        runs)
+            LC_ALL=C awk -v n=$n 'BEGIN {
+                srand(1);
+                for (t = 0; t < n; t += k) {
+                    k = int(rand() * 65536) + 1;
+                    c = sprintf("%c", int(rand() * 256));
+                    for (s = c; length(s) < k; )
+                        s = s s;
+                    printf "%s", substr(s, 1, k);
+                }
+            }' | head -c $n
+            ;;
+    esac
+}
+
+# best time of RUNS decodes of "$2" by "$1", then checks what it gave
+best() {
+    b=
+    r=0
+
+    while [ $r -lt "$RUNS" ]; do
+        t0=$(now)
+        "$1" d "$type" "$2" > /dev/null
+        t1=$(now)
+        b=$(awk -v a=$t0 -v z=$t1 -v b="$b" \
+            'BEGIN { t = z - a; print (b == "" || t < b) ? t : b }')
+        r=$((r + 1))
+    done
+
+    cmp -s "$DIR/in" "${2%.*}" || b=FAIL
+    echo "$b"
+}
+
+printf '%-6s %4s %-5s %9s %9s %7s\n' input MiB type old new speedup
+
+for input in text noise runs; do
+    for mib in $SIZES; do
+        make_input $input $mib > "$DIR/in"
+
+        for type in m g z i r; do
+            cp "$DIR/in" "$DIR/$type"
+            "$LZSZ" e $type "$DIR/$type" -f > /dev/null
+            f=$(ls "$DIR/$type".sz?)
+            a=$(best "$OLD" "$f")
+            b=$(best "$LZSZ" "$f")
+            rm -f "$DIR/$type" "$f"
+            awk -v i=$input -v m=$mib -v t=$type -v a="$a" -v b="$b" \
+                'BEGIN { if (a == "FAIL" || b == "FAIL")
+                             printf "%-6s %4d %-5s %9s %9s %7s\n",
+                                    i, m, t, a, b, "-";
+                         else
+                             printf "%-6s %4d %-5s %9.4f %9.4f %6.2fx\n",
+                                    i, m, t, a, b, a / b }'
+        done
+    done
+done
@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+#   Times lzsz encoding run-heavy inputs of doubling sizes.  Matches inside
+#   runs are found without searching, so the time per MiB should stay flat
+#   as the inputs grow, for every format, several formats at once, and the
+#   threaded pre-pass alike.
+#
+#   usage: tools/bench_runs.sh [lzsz] [MiB ...]
+#
+
+LZSZ=${1:-./lzsz}
+[ $# -gt 0 ] && shift
+SIZES=${*:-1 2 4 8}
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+now() {
+    date +%s.%N
+}
+
+# zeros, a 2 byte pattern, and runs of random bytes and lengths up to 64 KiB
+make_input() {
+    n=$(($2 * 1048576))
+
+    case $1 in
+        zeros)
+            head -c $n /dev/zero
+            ;;
+        abab)
+            yes ab | tr -d '\n' | head -c $n
+            ;;
+        runs)
+            awk -v n=$n 'BEGIN {
+                srand(1);
+                for (c = 0; c < 4; ++c) {
+                    for (s[c] = sprintf("%c", 65 + c); length(s[c]) < 1024; )
+                        s[c] = s[c] s[c];
+                }
+                for (t = 0; t < n; t += k) {
+                    k = int(rand() * 65536) + 1;
+                    c = int(rand() * 4);
+                    for (i = k; i >= 1024; i -= 1024)
+                        printf "%s", s[c];
+                    printf "%s", substr(s[c], 1, i);
+                }
+            }' | head -c $n
+            ;;
+    esac
+}
+
+printf '%-6s %4s  %-12s %8s %8s\n' input MiB mode seconds s/MiB
+
+for input in zeros abab runs; do
+    for mib in $SIZES; do
+        make_input $input $mib > "$DIR/in"
+
+        for mode in "m" "z" "r" "mzr" "z -t 4"; do
+            t0=$(now)
+            # shellcheck disable=SC2086
+            "$LZSZ" e ${mode%% *} "$DIR/in" ${mode#"${mode%% *}"} > /dev/null
+            t1=$(now)
+            rm -f "$DIR"/in.*
+            awk -v i=$input -v m=$mib -v o="$mode" -v a=$t0 -v b=$t1 \
+                'BEGIN { printf "%-6s %4d  %-12s %8.3f %8.4f\n",
+                         i, m, o, b - a, (b - a) / m }'
+        done
+    done
+done
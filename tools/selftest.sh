@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+#   Builds lzsz with LZSZ_SELFTEST and runs it, checking every match finder
+#   against search() at every position of random, low entropy and run-heavy
+#   inputs, and of real files, for the maximum lengths of all formats.  The
+#   files default to those of the tree.  Exits with the number of inputs a
+#   finder differed on.
+#
+#   usage: tools/selftest.sh [cc] [file ...]
+#
+
+CC=${1:-cc}
+[ $# -gt 0 ] && shift
+ROOT=$(dirname "$0")/..
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+[ $# -eq 0 ] && set -- "$ROOT/README" "$ROOT/doc/documentation.txt" \
+    "$ROOT/doc/documentation.pdf" "$ROOT/src/lzsz.c"
+
+"$CC" -std=c99 -Wall -Wextra -Wpedantic -O2 -pthread -DLZSZ_SELFTEST \
+    -o "$DIR/lzsz" "$ROOT/src/lzsz.c" || exit 1
+"$DIR/lzsz" "$@"